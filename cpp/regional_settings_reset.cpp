@@ -23,9 +23,52 @@
 #include <future>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <exception>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <string_view>
+#include <cctype>
+#include <array>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <memory_resource>
+#include <type_traits>
 #ifdef _WIN32
 #include <windows.h>
+#include <sddl.h>
 #include <shlobj.h>
+#include <psapi.h>
+#include <evntprov.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+// Demo-mode stand-ins so registry batches can be described on any platform
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef struct HKEY__* HKEY;
+#define HKEY_CURRENT_USER ((HKEY)(uintptr_t)0x80000001)
+#define HKEY_USERS ((HKEY)(uintptr_t)0x80000003)
+#define REG_SZ 1
+#define REG_EXPAND_SZ 2
+#define REG_BINARY 3
+#define REG_DWORD 4
+#define REG_MULTI_SZ 7
+#define REG_QWORD 11
+#define ERROR_SUCCESS 0L
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_INVALID_PARAMETER 87L
 #endif
 
 using namespace std;
@@ -49,411 +92,7179 @@ struct Config {
     vector<string> supported_locales;
     bool backup_enabled = true;
     bool log_enabled = true;
+    bool async_logging = true;
+    bool transactional_writes = true;
+    bool skip_unchanged = true;
     string log_path = "";
     string backup_path = "";
+    string backup_format = "binary"; // binary, reg or both
+    string log_level = "info";       // debug, info, warn or error
+    string profile_index_path = "profile_index.ridx";   // empty disables the multi-profile index
+    string perf_report_path = "";     // JSON Lines performance report, empty = off
+    string metrics_path = "";         // Prometheus text file, empty = off
+    bool include_offline_profiles = true;
+    int max_parallel_profiles = 0;     // 0 = one worker per hardware thread
+    int max_retries = 3;
+    int broadcast_timeout_ms = 5000;   // WM_SETTINGCHANGE deadline, 0 = no broadcast
+    int max_remote_connections = 8;    // --fleet hosts connected at once
+    int remote_connect_timeout_ms = 10000;
+    int remote_host_timeout_ms = 300000;   // one --fleet host from connect to last profile, 0 = no limit
+    int startup_budget_ms = 0;         // warn when startup exceeds this, 0 = off
+    map<string, bool> features;
+    string locale_catalog = "locales.rcat";
+    string system_locale_cache = "system_locales.rcat";   // OS locales, built in the background; empty = off
+    
+    bool feature(const string& name, bool fallback = false) const {
+        auto it = features.find(name);
+        return it != features.end() ? it->second : fallback;
+    }
+};
+
+uint32_t fnv1a32(const uint8_t* data, size_t size, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint64_t fnv1a64(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// UTF-8 <-> UTF-16 conversion shared by the registry and backup code.
+// Registry strings are UTF-16 on disk, everything else here is UTF-8.
+u16string utf8ToUtf16(const string& text) {
+    u16string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = text[i];
+        uint32_t cp;
+        size_t extra;
+        if (c < 0x80) { cp = c; extra = 0; }
+        else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+        else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+        else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; }
+        else { out.push_back(0xFFFD); i++; continue; }
+        if (i + extra >= text.size()) {
+            out.push_back(0xFFFD);
+            break;
+        }
+        for (size_t k = 1; k <= extra; k++) {
+            cp = (cp << 6) | (static_cast<unsigned char>(text[i + k]) & 0x3F);
+        }
+        i += extra + 1;
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            out.push_back(static_cast<char16_t>(0xD800 + (cp >> 10)));
+            out.push_back(static_cast<char16_t>(0xDC00 + (cp & 0x3FF)));
+        } else {
+            out.push_back(static_cast<char16_t>(cp));
+        }
+    }
+    return out;
+}
+
+string utf16ToUtf8(const char16_t* text, size_t length) {
+    string out;
+    out.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        uint32_t cp = text[i];
+        if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < length && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (text[i + 1] - 0xDC00);
+            i++;
+        }
+        if (cp < 0x80) {
+            out.push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    return out;
+}
+
+// Decode a REG_SZ-style payload (UTF-16LE, optionally NUL-terminated)
+string registryStringToUtf8(const vector<uint8_t>& data) {
+    u16string units;
+    for (size_t i = 0; i + 1 < data.size(); i += 2) {
+        char16_t unit = static_cast<char16_t>(data[i] | (data[i + 1] << 8));
+        if (unit == 0) break;
+        units.push_back(unit);
+    }
+    return utf16ToUtf8(units.data(), units.size());
+}
+
+// Encode a UTF-8 string as a NUL-terminated UTF-16LE REG_SZ payload
+vector<uint8_t> utf8ToRegistryString(const string& text) {
+    u16string units = utf8ToUtf16(text);
+    vector<uint8_t> data;
+    data.reserve((units.size() + 1) * 2);
+    for (char16_t unit : units) {
+        data.push_back(static_cast<uint8_t>(unit & 0xFF));
+        data.push_back(static_cast<uint8_t>(unit >> 8));
+    }
+    data.push_back(0);
+    data.push_back(0);
+    return data;
+}
+
+// Non-owning view of one locale's data. Points into the constexpr built-in
+// table, the mapped locale catalog or a LocaleInfo in the custom overlay.
+struct LocaleView {
+    string_view tag;
+    string_view name;
+    string_view country;
+    string_view shortDate;
+    string_view longDate;
+    string_view timeFormat;
+    string_view currency;
+    string_view decimalSep;
+    string_view thousandSep;
+    string_view listSep;
+    int countryCode = 0;
+    
+    static LocaleView of(const string& tag, const LocaleInfo& info) {
+        LocaleView view;
+        view.tag = tag;
+        view.name = info.name;
+        view.country = info.country;
+        view.shortDate = info.shortDate;
+        view.longDate = info.longDate;
+        view.timeFormat = info.timeFormat;
+        view.currency = info.currency;
+        view.decimalSep = info.decimalSep;
+        view.thousandSep = info.thousandSep;
+        view.listSep = info.listSep;
+        view.countryCode = info.countryCode;
+        return view;
+    }
+};
+
+// A LocaleView plus a reference on the snapshot its strings point into, so
+// a reload frees the old catalog once the last apply using it is done.
+// owner is null for data that lives as long as the process.
+struct PinnedLocale : LocaleView {
+    shared_ptr<const void> owner;
+    
+    PinnedLocale() = default;
+    explicit PinnedLocale(const LocaleView& view, shared_ptr<const void> owner = nullptr)
+        : LocaleView(view), owner(move(owner)) {}
+};
+
+// Built-in locales, fixed at compile time: no static-init allocation
+constexpr LocaleView kBuiltinLocales[] = {
+    {"pl-PL", "Polish (Poland)", "Poland", "dd.MM.yyyy", "d MMMM yyyy", "HH:mm:ss", "zł", ",", " ", ";", 48},
+    {"en-US", "English (United States)", "United States", "M/d/yyyy", "dddd, MMMM d, yyyy", "h:mm:ss tt", "$", ".", ",", ",", 1},
+    {"en-GB", "English (United Kingdom)", "United Kingdom", "dd/MM/yyyy", "dddd, d MMMM yyyy", "HH:mm:ss", "£", ".", ",", ",", 44},
+    {"de-DE", "German (Germany)", "Germany", "dd.MM.yyyy", "dddd, d. MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 49},
+    {"fr-FR", "French (France)", "France", "dd/MM/yyyy", "dddd d MMMM yyyy", "HH:mm:ss", "€", ",", " ", ";", 33},
+    {"es-ES", "Spanish (Spain)", "Spain", "dd/MM/yyyy", "dddd, d MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 34},
+    {"it-IT", "Italian (Italy)", "Italy", "dd/MM/yyyy", "dddd d MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 39},
+    {"ja-JP", "Japanese (Japan)", "Japan", "yyyy/MM/dd", "yyyy年M月d日", "H:mm:ss", "¥", ".", ",", ",", 81},
+    {"ko-KR", "Korean (Korea)", "Korea", "yyyy-MM-dd", "yyyy년 M월 d일 dddd", "tt h:mm:ss", "₩", ".", ",", ",", 82},
+    {"ru-RU", "Russian (Russia)", "Russia", "dd.MM.yyyy", "d MMMM yyyy г.", "H:mm:ss", "₽", ",", " ", ";", 7}
+};
+
+constexpr size_t kBuiltinLocaleCount = sizeof(kBuiltinLocales) / sizeof(kBuiltinLocales[0]);
+
+// Compile-time perfect hash over the built-in BCP-47 tags: a seed is
+// searched at compile time so every tag lands in its own slot
+namespace builtin_hash {
+    constexpr size_t kSlots = 32;   // power of two, > 3x the number of locales
+    
+    constexpr uint32_t hash(string_view text, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : text) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+    
+    constexpr bool collisionFree(uint32_t seed) {
+        bool used[kSlots] = {};
+        for (size_t i = 0; i < kBuiltinLocaleCount; i++) {
+            size_t slot = hash(kBuiltinLocales[i].tag, seed) & (kSlots - 1);
+            if (used[slot]) return false;
+            used[slot] = true;
+        }
+        return true;
+    }
+    
+    constexpr uint32_t findSeed() {
+        uint32_t seed = 0;
+        while (!collisionFree(seed)) seed++;
+        return seed;
+    }
+    
+    constexpr uint32_t kSeed = findSeed();
+    
+    struct SlotTable {
+        int8_t index[kSlots];
+    };
+    
+    constexpr SlotTable buildSlots() {
+        SlotTable table = {};
+        for (size_t i = 0; i < kSlots; i++) table.index[i] = -1;
+        for (size_t i = 0; i < kBuiltinLocaleCount; i++) {
+            table.index[hash(kBuiltinLocales[i].tag, kSeed) & (kSlots - 1)] = static_cast<int8_t>(i);
+        }
+        return table;
+    }
+    
+    constexpr SlotTable kSlotTable = buildSlots();
+}
+
+// O(1) lookup of a built-in locale: one hash, one slot read, one compare
+constexpr const LocaleView* findBuiltinLocale(string_view tag) {
+    int8_t index = builtin_hash::kSlotTable.index[builtin_hash::hash(tag, builtin_hash::kSeed) & (builtin_hash::kSlots - 1)];
+    if (index < 0 || kBuiltinLocales[index].tag != tag) return nullptr;
+    return &kBuiltinLocales[index];
+}
+
+static_assert(findBuiltinLocale("de-DE") != nullptr && findBuiltinLocale("de-DE")->countryCode == 49, "perfect hash lookup");
+static_assert(findBuiltinLocale("xx-XX") == nullptr, "perfect hash rejects unknown tags");
+
+// Fingerprint of the built-in table, stored in catalogs compiled from it so
+// a rebuilt binary with different built-ins does not map a stale catalog
+constexpr uint32_t builtinLocalesHash() {
+    uint32_t h = 2166136261u;
+    auto mix = [&h](string_view text) {
+        for (char c : text) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        h = (h ^ 0xFFu) * 16777619u;   // 0xFF never occurs in UTF-8: a field separator
+    };
+    for (size_t i = 0; i < kBuiltinLocaleCount; i++) {
+        const LocaleView& locale = kBuiltinLocales[i];
+        for (string_view field : {locale.tag, locale.name, locale.country, locale.shortDate, locale.longDate, locale.timeFormat,
+                                  locale.currency, locale.decimalSep, locale.thousandSep, locale.listSep}) {
+            mix(field);
+        }
+        for (int shift = 0; shift < 32; shift += 8) {
+            h ^= static_cast<uint8_t>(static_cast<uint32_t>(locale.countryCode) >> shift);
+            h *= 16777619u;
+        }
+    }
+    return h;
+}
+
+constexpr uint32_t kBuiltinLocalesHash = builtinLocalesHash();
+
+// Numeric identifiers used by the extended settings: the Windows LCID
+// (Office Options) and the GeoID written to International\Geo
+struct LocaleIds {
+    uint32_t lcid = 0;
+    int geoId = 0;
 };
 
-map<string, LocaleInfo> supportedLocales = {
-    {"pl-PL", {"Polish (Poland)", "Poland", "dd.MM.yyyy", "d MMMM yyyy", "HH:mm:ss", "zł", ",", " ", ";", 48}},
-    {"en-US", {"English (United States)", "United States", "M/d/yyyy", "dddd, MMMM d, yyyy", "h:mm:ss tt", "$", ".", ",", ",", 1}},
-    {"en-GB", {"English (United Kingdom)", "United Kingdom", "dd/MM/yyyy", "dddd, d MMMM yyyy", "HH:mm:ss", "£", ".", ",", ",", 44}},
-    {"de-DE", {"German (Germany)", "Germany", "dd.MM.yyyy", "dddd, d. MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 49}},
-    {"fr-FR", {"French (France)", "France", "dd/MM/yyyy", "dddd d MMMM yyyy", "HH:mm:ss", "€", ",", " ", ";", 33}},
-    {"es-ES", {"Spanish (Spain)", "Spain", "dd/MM/yyyy", "dddd, d MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 34}},
-    {"it-IT", {"Italian (Italy)", "Italy", "dd/MM/yyyy", "dddd d MMMM yyyy", "HH:mm:ss", "€", ",", ".", ";", 39}},
-    {"ja-JP", {"Japanese (Japan)", "Japan", "yyyy/MM/dd", "yyyy年M月d日", "H:mm:ss", "¥", ".", ",", ",", 81}},
-    {"ko-KR", {"Korean (Korea)", "Korea", "yyyy-MM-dd", "yyyy년 M월 d일 dddd", "tt h:mm:ss", "₩", ".", ",", ",", 82}},
-    {"ru-RU", {"Russian (Russia)", "Russia", "dd.MM.yyyy", "d MMMM yyyy г.", "H:mm:ss", "₽", ",", " ", ";", 7}}
+namespace locale_ids {
+    struct Entry {
+        string_view tag;
+        uint32_t lcid;
+        int geoId;
+    };
+    
+    // Fallback when the OS cannot resolve a tag (and the demo build)
+    constexpr Entry kKnown[] = {
+        {"pl-PL", 1045, 191}, {"en-US", 1033, 244}, {"en-GB", 2057, 242}, {"de-DE", 1031, 94},
+        {"fr-FR", 1036, 84},  {"es-ES", 3082, 217}, {"it-IT", 1040, 118}, {"pt-PT", 2070, 193},
+        {"ru-RU", 1049, 203}, {"zh-CN", 2052, 45},  {"ja-JP", 1041, 122}, {"ko-KR", 1042, 134}
+    };
+}
+
+LocaleIds resolveLocaleIds(const string& tag) {
+    LocaleIds ids;
+#ifdef _WIN32
+    u16string wideTag = utf8ToUtf16(tag);
+    LPCWSTR name = reinterpret_cast<LPCWSTR>(wideTag.c_str());
+    ids.lcid = LocaleNameToLCID(name, 0);
+    DWORD geo = 0;
+    if (GetLocaleInfoEx(name, LOCALE_IGEOID | LOCALE_RETURN_NUMBER, reinterpret_cast<LPWSTR>(&geo), sizeof(geo) / sizeof(WCHAR)) > 0) {
+        ids.geoId = static_cast<int>(geo);
+    }
+#endif
+    for (const auto& entry : locale_ids::kKnown) {
+        if (entry.tag != tag) continue;
+        if (ids.lcid == 0) ids.lcid = entry.lcid;
+        if (ids.geoId == 0) ids.geoId = entry.geoId;
+    }
+    return ids;
+}
+
+// Thread-safe replacement for localtime(), which shares one static buffer
+tm localTime(time_t value) {
+    tm result;
+#ifdef _WIN32
+    localtime_s(&result, &value);
+#else
+    localtime_r(&value, &result);
+#endif
+    return result;
+}
+
+// Bounded lock-free MPMC ring of formatted log records (Vyukov sequence queue).
+// Producers never take a lock; the single writer thread drains it.
+class LogRing {
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        string record;
+    };
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    atomic<size_t> enqueuePos;
+    atomic<size_t> dequeuePos;
+    
+public:
+    explicit LogRing(size_t capacity) : enqueuePos(0), dequeuePos(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+    
+    // Moves the record in on success; leaves it untouched when the ring is full
+    bool tryPush(string& record) {
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    slot.record = move(record);
+                    slot.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+    
+    bool tryPop(string& record) {
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    record = move(slot.record);
+                    slot.sequence.store(pos + mask + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+    }
+    
+    size_t sizeApprox() const {
+        size_t head = dequeuePos.load(memory_order_relaxed);
+        size_t tail = enqueuePos.load(memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
 };
 
+// Records below this level are compiled out: the call, its format string and
+// its arguments disappear. 0 keeps everything, 1 drops DEBUG, and so on.
+#ifndef REGRESET_MIN_LOG_LEVEL
+#define REGRESET_MIN_LOG_LEVEL 0
+#endif
+
+enum class LogLevel { Debug, Info, Warn, Error, Count };
+
+// Argument formatting for deferred log messages. Callables are invoked only
+// when the record is emitted, so an expensive rendering can be passed as a
+// lambda and costs nothing when the level is filtered out.
+template <typename T>
+void appendLogArg(string& out, const T& value) {
+    if constexpr (is_invocable_v<const T&>) {
+        appendLogArg(out, value());
+    } else if constexpr (is_convertible_v<const T&, string_view>) {
+        out.append(string_view(value));
+    } else if constexpr (is_same_v<T, char>) {
+        out.push_back(value);
+    } else if constexpr (is_same_v<T, bool>) {
+        out.append(value ? "true" : "false");
+    } else if constexpr (is_arithmetic_v<T>) {
+        out.append(to_string(value));
+    } else {
+        ostringstream text;
+        text << value;
+        out.append(text.str());
+    }
+}
+
+inline void formatLogInto(string& out, string_view format) {
+    out.append(format);
+}
+
+// std::format-style "{}" substitution, one argument per placeholder in order
+template <typename First, typename... Rest>
+void formatLogInto(string& out, string_view format, const First& first, const Rest&... rest) {
+    size_t slot = format.find("{}");
+    if (slot == string_view::npos) {
+        out.append(format);
+        return;
+    }
+    out.append(format.substr(0, slot));
+    appendLogArg(out, first);
+    formatLogInto(out, format.substr(slot + 2), rest...);
+}
+
 class Logger {
 private:
+    static constexpr size_t kRingCapacity = 1024;
+    static constexpr size_t kFlushBatch = 64;
+    static constexpr chrono::milliseconds kFlushInterval{200};
+    
+    static constexpr const char* kLevelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    static constexpr const char* kLevelColors[] = {"\033[36m", "\033[32m", "\033[33m", "\033[31m"};
+    
     string logFile;
     bool enabled;
+    atomic<int> minLevel;
     mutex logMutex;
     
+    // Async backend: one long-lived file handle fed by a background writer
+    atomic<bool> asyncMode;
+    LogRing ring;
+    mutex fileMutex;
+    ofstream fileStream;
+    mutex writerMutex;
+    atomic<bool> writerRunning;
+    thread writer;
+    mutex wakeMutex;
+    condition_variable wakeCv;
+    atomic<bool> stopping;
+    
+    static mutex& registryMutex() {
+        static mutex m;
+        return m;
+    }
+    
+    static vector<Logger*>& registry() {
+        static vector<Logger*> loggers;
+        return loggers;
+    }
+    
+    // Caller must hold fileMutex
+    void writeLine(const string& line) {
+        if (!fileStream.is_open()) {
+            fileStream.open(logFile, ios::app);
+        }
+        if (fileStream.is_open()) {
+            fileStream << line << '\n';
+        }
+    }
+    
+    // Caller must hold fileMutex
+    bool drainLocked() {
+        string record;
+        bool wrote = false;
+        while (ring.tryPop(record)) {
+            writeLine(record);
+            wrote = true;
+        }
+        return wrote;
+    }
+    
+    void drain() {
+        lock_guard<mutex> lock(fileMutex);
+        if (drainLocked() && fileStream.is_open()) {
+            fileStream.flush();
+        }
+    }
+    
+    // Crash-path drain: a thread that died holding fileMutex cannot release
+    // it, so give up rather than block the handler forever
+    void tryFlush() {
+        unique_lock<mutex> lock(fileMutex, try_to_lock);
+        if (!lock.owns_lock()) return;
+        drainLocked();
+        if (fileStream.is_open()) {
+            fileStream.flush();
+        }
+    }
+    
+    void writerLoop() {
+        unique_lock<mutex> wake(wakeMutex);
+        while (!stopping.load()) {
+            wakeCv.wait_for(wake, kFlushInterval, [this] {
+                return stopping.load() || ring.sizeApprox() >= kFlushBatch;
+            });
+            wake.unlock();
+            drain();
+            wake.lock();
+        }
+    }
+    
+    // The writer thread is started by the first queued record, so short
+    // runs that log little (or only synchronously) never spawn it
+    void ensureWriter() {
+        if (writerRunning.load(memory_order_acquire)) return;
+        lock_guard<mutex> lock(writerMutex);
+        if (writer.joinable() || !asyncMode.load()) return;
+        stopping = false;
+        writer = thread(&Logger::writerLoop, this);
+        writerRunning.store(true, memory_order_release);
+    }
+    
+    void stopWriter() {
+        lock_guard<mutex> lock(writerMutex);
+        writerRunning.store(false, memory_order_release);
+        if (!writer.joinable()) return;
+        {
+            lock_guard<mutex> wake(wakeMutex);
+            stopping = true;
+        }
+        wakeCv.notify_one();
+        writer.join();
+        drain();
+    }
+    
+    static void installCrashHandlers() {
+        static once_flag installed;
+        call_once(installed, [] {
+            // A normal exit waits for other writers; the crash paths below must not
+            atexit([] { Logger::flushAll(true); });
+            static terminate_handler previous = set_terminate([] {
+                Logger::flushAll();
+                if (previous) previous();
+                abort();
+            });
+#ifdef _WIN32
+            SetUnhandledExceptionFilter([](EXCEPTION_POINTERS*) -> LONG {
+                Logger::flushAll();
+                return EXCEPTION_CONTINUE_SEARCH;
+            });
+            SetConsoleCtrlHandler([](DWORD) -> BOOL {
+                Logger::flushAll();
+                return FALSE;
+            }, TRUE);
+#endif
+        });
+    }
+    
 public:
-    Logger(const string& filename = "", bool enable = true) : enabled(enable) {
+    Logger(const string& filename = "", bool enable = true, bool async = true)
+        : enabled(enable), minLevel(static_cast<int>(LogLevel::Info)), asyncMode(async), ring(kRingCapacity), writerRunning(false), stopping(false) {
         if (filename.empty()) {
             auto now = time(nullptr);
-            auto tm = *localtime(&now);
+            auto tm = localTime(now);
             stringstream ss;
             ss << "regional_settings_" << put_time(&tm, "%Y%m%d_%H%M%S") << ".log";
             logFile = ss.str();
         } else {
             logFile = filename;
         }
+        
+        installCrashHandlers();
+        {
+            lock_guard<mutex> lock(registryMutex());
+            registry().push_back(this);
+        }
+    }
+    
+    ~Logger() {
+        {
+            lock_guard<mutex> lock(registryMutex());
+            auto& loggers = registry();
+            loggers.erase(remove(loggers.begin(), loggers.end(), this), loggers.end());
+        }
+        stopWriter();
+        lock_guard<mutex> lock(fileMutex);
+        if (fileStream.is_open()) {
+            fileStream.close();
+        }
+    }
+    
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+    
+    // Switch between the background writer and synchronous per-line writes
+    void setAsync(bool async) {
+        if (async == asyncMode.load()) return;
+        asyncMode = async;
+        if (!async) stopWriter();
+    }
+    
+    // Write out everything queued so far; safe to call from any thread
+    void flush() {
+        drain();
+        lock_guard<mutex> lock(fileMutex);
+        if (fileStream.is_open()) {
+            fileStream.flush();
+        }
+    }
+    
+    // Last-chance flush. At exit it blocks like flush(); the terminate and
+    // crash handlers pass blocking = false, since the thread that died may
+    // hold either lock, and skip what they cannot lock.
+    static void flushAll(bool blocking = false) {
+        unique_lock<mutex> lock(registryMutex(), defer_lock);
+        if (blocking) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            return;
+        }
+        for (Logger* logger : registry()) {
+            if (blocking) {
+                logger->flush();
+            } else {
+                logger->tryFlush();
+            }
+        }
+    }
+    
+    // Runtime threshold on top of REGRESET_MIN_LOG_LEVEL
+    void setMinLevel(LogLevel level) { minLevel = static_cast<int>(level); }
+    
+    bool wants(LogLevel level) const {
+        return enabled && static_cast<int>(level) >= REGRESET_MIN_LOG_LEVEL && static_cast<int>(level) >= minLevel.load(memory_order_relaxed);
+    }
+    
+    static bool parseLevel(string_view name, LogLevel& level) {
+        for (int i = 0; i < static_cast<int>(LogLevel::Count); i++) {
+            string_view candidate = kLevelNames[i];
+            if (name.size() == candidate.size() && equal(name.begin(), name.end(), candidate.begin(), [](char a, char b) {
+                    return toupper(static_cast<unsigned char>(a)) == b;
+                })) {
+                level = static_cast<LogLevel>(i);
+                return true;
+            }
+        }
+        return false;
     }
     
-    void log(const string& level, const string& message) {
-        if (!enabled) return;
+    void log(LogLevel level, const string& message) {
+        if (!wants(level)) return;
         
         // Build strings outside of lock for better performance
         auto now = time(nullptr);
-        auto tm = *localtime(&now);
+        auto tm = localTime(now);
         
         stringstream timestamp;
         timestamp << put_time(&tm, "%Y-%m-%d %H:%M:%S");
         string timeStr = timestamp.str();
         
         stringstream logEntry;
-        logEntry << "[" << timeStr << "] [" << level << "] " << message;
+        logEntry << "[" << timeStr << "] [" << kLevelNames[static_cast<int>(level)] << "] " << message;
         string logStr = logEntry.str();
         
-        // Lock only for actual output (minimizes contention)
-        lock_guard<mutex> lock(logMutex);
-        
         // Console output with colors
-        string color = "\033[0m"; // Default
-        if (level == "ERROR") color = "\033[31m"; // Red
-        else if (level == "WARN") color = "\033[33m"; // Yellow
-        else if (level == "INFO") color = "\033[32m"; // Green
-        else if (level == "DEBUG") color = "\033[36m"; // Cyan
+        const char* color = kLevelColors[static_cast<int>(level)];
+        
+        bool synchronous = !asyncMode.load() || level == LogLevel::Error;
+        {
+            // Lock only for actual output (minimizes contention)
+            lock_guard<mutex> lock(logMutex);
+            cout << color << logStr << "\033[0m" << '\n';
+            if (synchronous) cout.flush();
+        }
         
-        cout << color << logStr << "\033[0m" << endl;
+        if (!synchronous) {
+            ensureWriter();
+            if (ring.tryPush(logStr)) {
+                if (ring.sizeApprox() >= kFlushBatch) wakeCv.notify_one();
+                return;
+            }
+            // Ring full: apply backpressure by draining on the caller's thread
+            drain();
+            if (ring.tryPush(logStr)) return;
+        }
         
-        // File output
-        ofstream logStream(logFile, ios::app);
-        if (logStream.is_open()) {
-            logStream << logStr << endl;
-            logStream.close();
+        // Synchronous path (sync mode, ERROR records, or a saturated ring):
+        // queued records go out first so the file stays in order
+        lock_guard<mutex> lock(fileMutex);
+        drainLocked();
+        writeLine(logStr);
+        if (fileStream.is_open()) {
+            fileStream.flush();
+        }
+    }
+    
+    // Format only once the level check passes; a level below
+    // REGRESET_MIN_LOG_LEVEL compiles to nothing
+    template <LogLevel level, typename... Args>
+    void emit(string_view format, const Args&... args) {
+        if constexpr (static_cast<int>(level) >= REGRESET_MIN_LOG_LEVEL) {
+            if (!wants(level)) return;
+            string message;
+            formatLogInto(message, format, args...);
+            log(level, message);
         }
     }
     
-    void info(const string& message) { log("INFO", message); }
-    void warn(const string& message) { log("WARN", message); }
-    void error(const string& message) { log("ERROR", message); }
-    void debug(const string& message) { log("DEBUG", message); }
+    template <typename... Args> void debug(string_view format, const Args&... args) { emit<LogLevel::Debug>(format, args...); }
+    template <typename... Args> void info(string_view format, const Args&... args) { emit<LogLevel::Info>(format, args...); }
+    template <typename... Args> void warn(string_view format, const Args&... args) { emit<LogLevel::Warn>(format, args...); }
+    template <typename... Args> void error(string_view format, const Args&... args) { emit<LogLevel::Error>(format, args...); }
 };
 
-class PerformanceMonitor {
+string jsonEscape(const string& text) {
+    string out;
+    out.reserve(text.size() + 2);
+    for (char c : text) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
+// Event callbacks for JsonReader. Handlers only override what they need.
+class JsonSaxHandler {
+public:
+    virtual ~JsonSaxHandler() {}
+    virtual void startObject() {}
+    virtual void endObject() {}
+    virtual void startArray() {}
+    virtual void endArray() {}
+    virtual void key(const string& name) { (void)name; }
+    virtual void stringValue(const string& value) { (void)value; }
+    virtual void numberValue(double value) { (void)value; }
+    virtual void boolValue(bool value) { (void)value; }
+    virtual void nullValue() {}
+};
+
+// Single-pass SAX-style JSON reader working directly on the stream buffer,
+// so config files are never copied into an intermediate string
+class JsonReader {
 private:
-    chrono::steady_clock::time_point startTime;
-    size_t startMemory;
+    static constexpr int kMaxDepth = 64;
     
-public:
-    void start() {
-        startTime = chrono::steady_clock::now();
-        startMemory = getCurrentMemoryUsage();
-    }
+    streambuf* in;
+    int line = 1;
+    string error;
     
-    void stop(Logger& logger) {
-        auto endTime = chrono::steady_clock::now();
-        auto duration = chrono::duration_cast<chrono::milliseconds>(endTime - startTime);
-        size_t endMemory = getCurrentMemoryUsage();
-        
-        logger.info("Performance Summary:");
-        logger.info("  Execution Time: " + to_string(duration.count()) + " ms");
-        logger.info("  Memory Usage: " + to_string((long long)endMemory - (long long)startMemory) + " bytes");
+    int peek() { return in->sgetc(); }
+    int next() {
+        int c = in->sbumpc();
+        if (c == '\n') line++;
+        return c;
     }
     
-private:
-    size_t getCurrentMemoryUsage() {
-        // Simplified memory usage calculation
-        return 0; // Would implement platform-specific memory monitoring
+    void skipWhitespace() {
+        for (int c = peek(); c == ' ' || c == '\t' || c == '\r' || c == '\n'; c = peek()) next();
     }
-};
-
-class RegionalSettingsManager {
-private:
-    Config config;
-    Logger logger;
-    string backupDir;
-    atomic<int> operationCount;
-    atomic<int> successCount;
-    atomic<int> errorCount;
-    PerformanceMonitor perfMonitor;
     
-    string getCurrentTimestamp() {
-        auto now = time(nullptr);
-        auto tm = *localtime(&now);
-        stringstream ss;
-        ss << put_time(&tm, "%Y%m%d_%H%M%S");
-        return ss.str();
+    bool fail(const string& message) {
+        if (error.empty()) error = "line " + to_string(line) + ": " + message;
+        return false;
     }
     
-    bool loadConfig(const string& configFile = "config.json") {
-        ifstream file(configFile);
-        if (!file.is_open()) {
-            logger.warn("Config file not found: " + configFile + ", using defaults");
-            return false;
+    bool expect(const char* literal) {
+        for (const char* p = literal; *p; p++) {
+            if (next() != *p) return fail(string("invalid literal, expected ") + literal);
         }
-        
-        string line, content;
-        while (getline(file, line)) {
-            content += line;
+        return true;
+    }
+    
+    bool readHex4(uint32_t& value) {
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            int c = next();
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return fail("invalid \\u escape");
         }
-        file.close();
-        
-        // Simple JSON parsing for basic config
-        size_t pos = content.find("\"default_locale\"");
-        if (pos != string::npos) {
-            pos = content.find(":", pos);
-            pos = content.find("\"", pos);
-            size_t end = content.find("\"", pos + 1);
-            if (pos != string::npos && end != string::npos) {
-                config.default_locale = content.substr(pos + 1, end - pos - 1);
+        return true;
+    }
+    
+    bool readString(string& out) {
+        out.clear();
+        next(); // opening quote
+        for (;;) {
+            int c = next();
+            if (c == EOF) return fail("unterminated string");
+            if (c == '"') return true;
+            if (c != '\\') {
+                out.push_back(static_cast<char>(c));
+                continue;
+            }
+            c = next();
+            switch (c) {
+                case '"': out.push_back('"'); break;
+                case '\\': out.push_back('\\'); break;
+                case '/': out.push_back('/'); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u': {
+                    uint32_t unit;
+                    if (!readHex4(unit)) return false;
+                    char16_t units[2] = {static_cast<char16_t>(unit), 0};
+                    size_t count = 1;
+                    if (unit >= 0xD800 && unit <= 0xDBFF && peek() == '\\') {
+                        next();
+                        uint32_t low;
+                        if (next() != 'u' || !readHex4(low)) return fail("invalid surrogate pair");
+                        units[1] = static_cast<char16_t>(low);
+                        count = 2;
+                    }
+                    out += utf16ToUtf8(units, count);
+                    break;
+                }
+                default:
+                    return fail("invalid escape sequence");
             }
         }
-        
-        pos = content.find("\"backup_enabled\"");
-        if (pos != string::npos) {
-            pos = content.find(":", pos);
-            pos = content.find_first_not_of(" \t", pos + 1);
-            config.backup_enabled = (content.substr(pos, 4) == "true");
-        }
-        
-        pos = content.find("\"log_enabled\"");
-        if (pos != string::npos) {
-            pos = content.find(":", pos);
-            pos = content.find_first_not_of(" \t", pos + 1);
-            config.log_enabled = (content.substr(pos, 4) == "true");
+    }
+    
+    bool readNumber(JsonSaxHandler& handler) {
+        char buffer[64];
+        size_t length = 0;
+        for (int c = peek(); (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'; c = peek()) {
+            if (length + 1 >= sizeof(buffer)) return fail("number too long");
+            buffer[length++] = static_cast<char>(next());
         }
-        
-        logger.info("Configuration loaded successfully");
-        loadCustomLocales();
+        buffer[length] = '\0';
+        char* end = nullptr;
+        double value = strtod(buffer, &end);
+        if (length == 0 || end != buffer + length) return fail("invalid number");
+        handler.numberValue(value);
         return true;
     }
     
-    bool loadCustomLocales(const string& customFile = "custom_locales.json") {
-        ifstream file(customFile);
-        if (!file.is_open()) {
-            logger.info("No custom locales file found: " + customFile);
-            return false;
-        }
-        
-        string line, content;
-        while (getline(file, line)) {
-            content += line;
+    bool readValue(JsonSaxHandler& handler, int depth) {
+        if (depth > kMaxDepth) return fail("nesting too deep");
+        skipWhitespace();
+        int c = peek();
+        if (c == '{') {
+            next();
+            handler.startObject();
+            skipWhitespace();
+            if (peek() == '}') {
+                next();
+                handler.endObject();
+                return true;
+            }
+            for (;;) {
+                skipWhitespace();
+                if (peek() != '"') return fail("expected object key");
+                string name;
+                if (!readString(name)) return false;
+                skipWhitespace();
+                if (next() != ':') return fail("expected ':' after key");
+                handler.key(name);
+                if (!readValue(handler, depth + 1)) return false;
+                skipWhitespace();
+                c = next();
+                if (c == '}') break;
+                if (c != ',') return fail("expected ',' or '}'");
+            }
+            handler.endObject();
+            return true;
         }
-        file.close();
-        
-        // Add custom locales
-        vector<pair<string, LocaleInfo>> customLocales = {
-            {"en-AU", {"English (Australia)", "Australia", "d/MM/yyyy", "dddd, d MMMM yyyy", "h:mm:ss tt", "$", ".", ",", ",", 61}},
-            {"pt-BR", {"Portuguese (Brazil)", "Brazil", "dd/MM/yyyy", "dddd, d 'de' MMMM 'de' yyyy", "HH:mm:ss", "R$", ",", ".", ";", 55}},
-            {"zh-TW", {"Chinese (Traditional, Taiwan)", "Taiwan", "yyyy/M/d", "yyyy年M月d日", "tt h:mm:ss", "NT$", ".", ",", ",", 886}}
-        };
-        
-        for (const auto& locale : customLocales) {
-            if (content.find("\"" + locale.first + "\"") != string::npos) {
-                supportedLocales[locale.first] = locale.second;
-                logger.info("Loaded custom locale: " + locale.first);
+        if (c == '[') {
+            next();
+            handler.startArray();
+            skipWhitespace();
+            if (peek() == ']') {
+                next();
+                handler.endArray();
+                return true;
+            }
+            for (;;) {
+                if (!readValue(handler, depth + 1)) return false;
+                skipWhitespace();
+                c = next();
+                if (c == ']') break;
+                if (c != ',') return fail("expected ',' or ']'");
             }
+            handler.endArray();
+            return true;
         }
-        
+        if (c == '"') {
+            string value;
+            if (!readString(value)) return false;
+            handler.stringValue(value);
+            return true;
+        }
+        if (c == 't') {
+            if (!expect("true")) return false;
+            handler.boolValue(true);
+            return true;
+        }
+        if (c == 'f') {
+            if (!expect("false")) return false;
+            handler.boolValue(false);
+            return true;
+        }
+        if (c == 'n') {
+            if (!expect("null")) return false;
+            handler.nullValue();
+            return true;
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) return readNumber(handler);
+        return fail(c == EOF ? "unexpected end of input" : "unexpected character");
+    }
+    
+public:
+    explicit JsonReader(istream& stream) : in(stream.rdbuf()) {}
+    
+    bool parse(JsonSaxHandler& handler) {
+        if (in == nullptr) return fail("no input");
+        if (!readValue(handler, 0)) return false;
+        skipWhitespace();
+        if (peek() != EOF) return fail("trailing characters after document");
         return true;
     }
     
-#ifdef _WIN32
-    // RAII wrapper for registry key
-    class RegistryKeyGuard {
-    private:
-        HKEY hKey;
-        bool valid;
-    public:
-        RegistryKeyGuard() : hKey(NULL), valid(false) {}
-        
-        bool open(const string& key, REGSAM access = KEY_SET_VALUE) {
-            LONG result = RegCreateKeyExA(HKEY_CURRENT_USER, key.c_str(), 0, NULL, 0, access, NULL, &hKey, NULL);
-            valid = (result == ERROR_SUCCESS);
-            return valid;
+    const string& lastError() const { return error; }
+};
+
+// Maps config.json onto Config as the reader streams through it
+class ConfigJsonHandler : public JsonSaxHandler {
+private:
+    Config& config;
+    int depth = 0;
+    string currentKey;
+    string section;     // top-level key of the object/array being read
+    
+public:
+    explicit ConfigJsonHandler(Config& target) : config(target) {}
+    
+    void startObject() override {
+        if (++depth == 2) section = currentKey;
+    }
+    void endObject() override {
+        if (depth-- == 2) section.clear();
+    }
+    void startArray() override {
+        if (++depth == 2) {
+            section = currentKey;
+            if (section == "supported_locales") config.supported_locales.clear();
+        }
+    }
+    void endArray() override {
+        if (depth-- == 2) section.clear();
+    }
+    void key(const string& name) override { currentKey = name; }
+    
+    void stringValue(const string& value) override {
+        if (depth == 2 && section == "supported_locales") {
+            config.supported_locales.push_back(value);
+        } else if (depth == 1) {
+            if (currentKey == "default_locale") config.default_locale = value;
+            else if (currentKey == "log_path") config.log_path = value;
+            else if (currentKey == "backup_path") config.backup_path = value;
+            else if (currentKey == "backup_format") config.backup_format = value;
+            else if (currentKey == "log_level") config.log_level = value;
+            else if (currentKey == "profile_index_path") config.profile_index_path = value;
+            else if (currentKey == "perf_report_path") config.perf_report_path = value;
+            else if (currentKey == "metrics_path") config.metrics_path = value;
+            else if (currentKey == "locale_catalog") config.locale_catalog = value;
+            else if (currentKey == "system_locale_cache") config.system_locale_cache = value;
+        }
+    }
+    
+    void boolValue(bool value) override {
+        if (depth == 2 && section == "features") {
+            config.features[currentKey] = value;
+        } else if (depth == 1) {
+            if (currentKey == "backup_enabled") config.backup_enabled = value;
+            else if (currentKey == "log_enabled") config.log_enabled = value;
+            else if (currentKey == "async_logging") config.async_logging = value;
+            else if (currentKey == "transactional_writes") config.transactional_writes = value;
+            else if (currentKey == "skip_unchanged") config.skip_unchanged = value;
+            else if (currentKey == "include_offline_profiles") config.include_offline_profiles = value;
+        }
+    }
+    
+    void numberValue(double value) override {
+        if (depth != 1) return;
+        if (currentKey == "max_retries") config.max_retries = static_cast<int>(value);
+        else if (currentKey == "max_parallel_profiles") config.max_parallel_profiles = static_cast<int>(value);
+        else if (currentKey == "broadcast_timeout_ms") config.broadcast_timeout_ms = static_cast<int>(value);
+        else if (currentKey == "max_remote_connections") config.max_remote_connections = static_cast<int>(value);
+        else if (currentKey == "remote_connect_timeout_ms") config.remote_connect_timeout_ms = static_cast<int>(value);
+        else if (currentKey == "remote_host_timeout_ms") config.remote_host_timeout_ms = static_cast<int>(value);
+        else if (currentKey == "startup_budget_ms") config.startup_budget_ms = static_cast<int>(value);
+    }
+};
+
+// Collects every entry under "custom_locales" in custom_locales.json
+class CustomLocalesJsonHandler : public JsonSaxHandler {
+private:
+    vector<pair<string, LocaleInfo>>& locales;
+    int depth = 0;
+    string currentKey;
+    bool inCustomLocales = false;
+    string tag;
+    LocaleInfo info;
+    
+public:
+    explicit CustomLocalesJsonHandler(vector<pair<string, LocaleInfo>>& target) : locales(target) {}
+    
+    void startObject() override {
+        depth++;
+        if (depth == 2) inCustomLocales = (currentKey == "custom_locales");
+        if (depth == 3 && inCustomLocales) {
+            tag = currentKey;
+            info = LocaleInfo();
+            info.countryCode = 0;
+        }
+    }
+    void endObject() override {
+        if (depth == 3 && inCustomLocales && !tag.empty()) {
+            locales.emplace_back(tag, info);
+            tag.clear();
+        }
+        if (depth == 2) inCustomLocales = false;
+        depth--;
+    }
+    void startArray() override { depth++; }
+    void endArray() override { depth--; }
+    void key(const string& name) override { currentKey = name; }
+    
+    void stringValue(const string& value) override {
+        if (depth != 3 || tag.empty()) return;
+        if (currentKey == "name") info.name = value;
+        else if (currentKey == "country") info.country = value;
+        else if (currentKey == "shortDate") info.shortDate = value;
+        else if (currentKey == "longDate") info.longDate = value;
+        else if (currentKey == "timeFormat") info.timeFormat = value;
+        else if (currentKey == "currency") info.currency = value;
+        else if (currentKey == "decimalSep") info.decimalSep = value;
+        else if (currentKey == "thousandSep") info.thousandSep = value;
+        else if (currentKey == "listSep") info.listSep = value;
+    }
+    
+    void numberValue(double value) override {
+        if (depth == 3 && !tag.empty() && currentKey == "countryCode") {
+            info.countryCode = static_cast<int>(value);
+        }
+    }
+};
+
+// Process-wide metrics: counters and latency histograms that the parallel
+// workers update with relaxed atomics only. Series are found in a fixed
+// open-addressed table whose slots are claimed by CAS, so recording never
+// takes a lock. Exported as Prometheus text and, on Windows, as ETW events.
+class MetricsRegistry {
+public:
+    enum Family { PhaseDuration, ValueWriteDuration, RegistryWrites, ArenaBytes, FamilyCount };
+    
+    struct Sample {
+        string name;
+        string help;
+        uint64_t value;
+    };
+    
+private:
+    static constexpr size_t kSlots = 256;   // power of two
+    static constexpr size_t kBuckets = 14;
+    static constexpr uint64_t kBoundsUs[kBuckets] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+                                                      50000, 100000, 250000, 500000, 1000000};
+    
+    struct Series {
+        atomic<uint64_t> key{0};            // 0 = free, otherwise hash of family + label
+        atomic<bool> ready{false};          // label published
+        int family = 0;
+        string label;
+        atomic<uint64_t> buckets[kBuckets + 1] = {};    // last one is +Inf
+        atomic<uint64_t> count{0};
+        atomic<uint64_t> sumUs{0};
+    };
+    
+    Series series[kSlots];
+#ifdef _WIN32
+    REGHANDLE etw = 0;
+#endif
+    
+    MetricsRegistry() {
+#ifdef _WIN32
+        // {5B0F3C1E-6A2D-4E8B-9C71-2F4D8A6E3B10} RegionalSettingsReset
+        static const GUID provider = {0x5b0f3c1e, 0x6a2d, 0x4e8b, {0x9c, 0x71, 0x2f, 0x4d, 0x8a, 0x6e, 0x3b, 0x10}};
+        if (EventRegister(&provider, NULL, NULL, &etw) != ERROR_SUCCESS) etw = 0;
+#endif
+    }
+    
+    ~MetricsRegistry() {
+#ifdef _WIN32
+        if (etw != 0) EventUnregister(etw);
+#endif
+    }
+    
+    Series* find(Family family, string_view label) {
+        uint64_t key = fnv1a64(reinterpret_cast<const uint8_t*>(label.data()), label.size(), 14695981039346656037ull ^ family) | 1;
+        for (size_t probe = 0; probe < kSlots; probe++) {
+            Series& slot = series[(key + probe) & (kSlots - 1)];
+            uint64_t current = slot.key.load(memory_order_acquire);
+            if (current == 0) {
+                if (slot.key.compare_exchange_strong(current, key, memory_order_acq_rel)) {
+                    slot.family = family;
+                    slot.label.assign(label.data(), label.size());
+                    slot.ready.store(true, memory_order_release);
+                    return &slot;
+                }
+            }
+            if (current == key) return &slot;
+        }
+        return nullptr;     // table full: drop the sample rather than block
+    }
+    
+    static const char* familyName(int family) {
+        switch (family) {
+            case PhaseDuration: return "regreset_phase_duration_seconds";
+            case ValueWriteDuration: return "regreset_value_write_duration_seconds";
+            case ArenaBytes: return "regreset_arena_bytes_total";
+            default: return "regreset_registry_writes_total";
+        }
+    }
+    
+    static const char* labelName(int family) {
+        switch (family) {
+            case PhaseDuration: return "phase";
+            case ValueWriteDuration: return "value";
+            case ArenaBytes: return "scope";
+            default: return "result";
+        }
+    }
+    
+    static bool isCounter(int family) { return family == RegistryWrites || family == ArenaBytes; }
+    
+    static string seconds(uint64_t micros) {
+        stringstream ss;
+        ss << setprecision(6) << micros / 1e6;
+        return ss.str();
+    }
+    
+public:
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+    
+    void observe(Family family, string_view label, chrono::microseconds elapsed) {
+        Series* slot = find(family, label);
+        if (slot == nullptr) return;
+        uint64_t micros = static_cast<uint64_t>(max<long long>(0, elapsed.count()));
+        size_t bucket = lower_bound(kBoundsUs, kBoundsUs + kBuckets, micros) - kBoundsUs;
+        slot->buckets[bucket].fetch_add(1, memory_order_relaxed);
+        slot->count.fetch_add(1, memory_order_relaxed);
+        slot->sumUs.fetch_add(micros, memory_order_relaxed);
+#ifdef _WIN32
+        // EventProviderEnabled is a cheap in-process check; the string is only
+        // built while a trace session is listening at this level
+        if (etw != 0 && family == PhaseDuration && EventProviderEnabled(etw, 4, 0)) {
+            u16string text = utf8ToUtf16(string(label) + " " + to_string(micros) + "us");
+            EventWriteString(etw, 4, 0, reinterpret_cast<PCWSTR>(text.c_str()));
+        }
+#endif
+    }
+    
+    void count(Family family, string_view label, uint64_t amount = 1) {
+        Series* slot = find(family, label);
+        if (slot != nullptr) slot->count.fetch_add(amount, memory_order_relaxed);
+    }
+    
+    // Prometheus text exposition format (0.0.4); extra holds plain counters
+    void writePrometheus(ostream& out, const vector<Sample>& extra) const {
+        for (const auto& sample : extra) {
+            out << "# HELP " << sample.name << " " << sample.help << "\n";
+            out << "# TYPE " << sample.name << " counter\n";
+            out << sample.name << " " << sample.value << "\n";
+        }
+        for (int family = 0; family < FamilyCount; family++) {
+            bool headed = false;
+            for (const auto& slot : series) {
+                if (!slot.ready.load(memory_order_acquire) || slot.family != family) continue;
+                const char* name = familyName(family);
+                string label = string(labelName(family)) + "=\"" + jsonEscape(slot.label) + "\"";
+                if (!headed) {
+                    out << "# TYPE " << name << (isCounter(family) ? " counter" : " histogram") << "\n";
+                    headed = true;
+                }
+                if (isCounter(family)) {
+                    out << name << "{" << label << "} " << slot.count.load(memory_order_relaxed) << "\n";
+                    continue;
+                }
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i <= kBuckets; i++) {
+                    cumulative += slot.buckets[i].load(memory_order_relaxed);
+                    out << name << "_bucket{" << label << ",le=\"" << (i < kBuckets ? seconds(kBoundsUs[i]) : "+Inf") << "\"} "
+                        << cumulative << "\n";
+                }
+                out << name << "_sum{" << label << "} " << seconds(slot.sumUs.load(memory_order_relaxed)) << "\n";
+                out << name << "_count{" << label << "} " << slot.count.load(memory_order_relaxed) << "\n";
+            }
+        }
+    }
+    
+    // Replace the file in one step so a textfile collector never reads half of it
+    bool writePrometheusFile(const string& path, const vector<Sample>& extra) const {
+        string temp = path + ".tmp";
+        {
+            ofstream out(temp, ios::trunc);
+            if (!out.is_open()) return false;
+            writePrometheus(out, extra);
+            if (!out.good()) return false;
+        }
+        error_code ec;
+        fs::rename(temp, path, ec);
+        return !ec;
+    }
+};
+
+class PerformanceMonitor {
+public:
+    struct MemoryInfo {
+        size_t workingSet = 0;
+        size_t peakWorkingSet = 0;
+    };
+    
+    // Adds the lifetime of the scope to a named phase
+    class Phase {
+    private:
+        PerformanceMonitor& monitor;
+        string name;
+        chrono::steady_clock::time_point begin;
+    public:
+        Phase(PerformanceMonitor& m, const string& phaseName)
+            : monitor(m), name(phaseName), begin(chrono::steady_clock::now()) {}
+        ~Phase() {
+            monitor.record(name, chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin));
+        }
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+    };
+    
+private:
+    chrono::steady_clock::time_point startTime;
+    chrono::steady_clock::time_point pauseTime;
+    chrono::microseconds waited{0};
+    bool paused = false;
+    MemoryInfo startMemory;
+    vector<pair<string, chrono::microseconds>> phases;  // insertion order preserved
+    string reportPath;
+    
+public:
+    void start() {
+        startTime = chrono::steady_clock::now();
+        waited = chrono::microseconds(0);
+        paused = false;
+        phases.clear();
+        startMemory = getCurrentMemoryUsage();
+    }
+    
+    // Exclude time spent waiting on the user (confirmation prompts)
+    void pause() {
+        if (paused) return;
+        pauseTime = chrono::steady_clock::now();
+        paused = true;
+    }
+    
+    void resume() {
+        if (!paused) return;
+        waited += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - pauseTime);
+        paused = false;
+    }
+    
+    Phase phase(const string& name) {
+        return Phase(*this, name);
+    }
+    
+    void record(const string& name, chrono::microseconds elapsed) {
+        MetricsRegistry::instance().observe(MetricsRegistry::PhaseDuration, name, elapsed);
+        for (auto& entry : phases) {
+            if (entry.first == name) {
+                entry.second += elapsed;
+                return;
+            }
+        }
+        phases.emplace_back(name, elapsed);
+    }
+    
+    // Append one JSON object per completed run to this file (JSON Lines)
+    void setReportPath(const string& path) { reportPath = path; }
+    
+    void stop(Logger& logger, const string& label = "") {
+        resume();
+        auto endTime = chrono::steady_clock::now();
+        auto total = chrono::duration_cast<chrono::microseconds>(endTime - startTime) - waited;
+        MemoryInfo endMemory = getCurrentMemoryUsage();
+        long long memoryDelta = (long long)endMemory.workingSet - (long long)startMemory.workingSet;
+        
+        logger.info("Performance Summary:");
+        if (waited.count() > 0) {
+            logger.info("  Execution Time: {} (excluding {} waiting for input)", formatMicros(total), formatMicros(waited));
+        } else {
+            logger.info("  Execution Time: {}", formatMicros(total));
+        }
+        for (const auto& entry : phases) {
+            logger.info("    {}: {}", entry.first, formatMicros(entry.second));
+        }
+        logger.info("  Memory Usage: {} bytes (working set {}, peak {})", memoryDelta, endMemory.workingSet, endMemory.peakWorkingSet);
+        
+        if (!reportPath.empty()) {
+            ofstream report(reportPath, ios::app);
+            if (report.is_open()) {
+                report << toJson(label, total, endMemory, memoryDelta) << '\n';
+            } else {
+                logger.warn("Failed to write performance report: {}", reportPath);
+            }
+        }
+    }
+    
+    static MemoryInfo getCurrentMemoryUsage() {
+        MemoryInfo info;
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters;
+        counters.cb = sizeof(counters);
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            info.workingSet = counters.WorkingSetSize;
+            info.peakWorkingSet = counters.PeakWorkingSetSize;
+        }
+#else
+        ifstream statm("/proc/self/statm");
+        size_t pages = 0, resident = 0;
+        if (statm >> pages >> resident) {
+            info.workingSet = resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+            info.peakWorkingSet = static_cast<size_t>(usage.ru_maxrss);          // bytes
+#else
+            info.peakWorkingSet = static_cast<size_t>(usage.ru_maxrss) * 1024;   // kilobytes
+#endif
+        }
+#endif
+        return info;
+    }
+    
+    static string formatMicros(chrono::microseconds value) {
+        stringstream ss;
+        ss << fixed << setprecision(3) << value.count() / 1000.0 << " ms";
+        return ss.str();
+    }
+    
+private:
+    string toJson(const string& label, chrono::microseconds total, const MemoryInfo& memory, long long memoryDelta) const {
+        stringstream json;
+        const char* host = getenv("COMPUTERNAME");
+        if (host == nullptr) host = getenv("HOSTNAME");
+        json << "{\"timestamp\":" << time(nullptr)
+             << ",\"host\":\"" << jsonEscape(host ? host : "") << "\""
+             << ",\"label\":\"" << jsonEscape(label) << "\""
+             << ",\"total_us\":" << total.count()
+             << ",\"user_wait_us\":" << waited.count()
+             << ",\"phases_us\":{";
+        for (size_t i = 0; i < phases.size(); i++) {
+            if (i > 0) json << ",";
+            json << "\"" << jsonEscape(phases[i].first) << "\":" << phases[i].second.count();
+        }
+        json << "},\"memory\":{\"working_set_bytes\":" << memory.workingSet
+             << ",\"peak_working_set_bytes\":" << memory.peakWorkingSet
+             << ",\"delta_bytes\":" << memoryDelta << "}}";
+        return json.str();
+    }
+};
+
+// Force a closed file's data to disk; ofstream::flush only reaches the OS
+// cache, which a power loss right after a registry write would discard
+bool syncFile(const string& path) {
+#ifdef _WIN32
+    u16string widePath = utf8ToUtf16(path);
+    HANDLE file = CreateFileW(reinterpret_cast<LPCWSTR>(widePath.c_str()), GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    bool synced = FlushFileBuffers(file) != 0;
+    CloseHandle(file);
+    return synced;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#endif
+}
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const uint8_t* base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    
+public:
+#ifdef _WIN32
+    MappedFile() : base(nullptr), length(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+    MappedFile() : base(nullptr), length(0) {}
+#endif
+    
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        u16string widePath = utf8ToUtf16(path);
+        file = CreateFileW(reinterpret_cast<LPCWSTR>(widePath.c_str()), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            close();
+            return false;
+        }
+        base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) return false;
+        base = static_cast<const uint8_t*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (base == nullptr) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+#ifdef _WIN32
+        if (base != nullptr) UnmapViewOfFile(base);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base != nullptr) munmap(const_cast<uint8_t*>(base), length);
+#endif
+        base = nullptr;
+        length = 0;
+    }
+    
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+    bool isOpen() const { return base != nullptr; }
+    
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Precompiled locale table, memory-mapped at startup so no JSON has to be
+// parsed and lookups never allocate.
+//
+// Layout (little-endian, every section 8-byte aligned):
+//   Header
+//   Entry[entryCount]   fixed-size records sorted by tag
+//   string pool         NUL-terminated UTF-8, referenced by (offset, length)
+class LocaleCatalog {
+public:
+    enum Field { Tag, Name, Country, ShortDate, LongDate, TimeFormat, Currency, DecimalSep, ThousandSep, ListSep, FieldCount };
+    
+    struct Header {
+        char magic[4];
+        uint16_t version;
+        uint16_t fieldCount;
+        uint32_t entryCount;
+        uint32_t entriesOffset;
+        uint32_t poolOffset;
+        uint32_t poolSize;
+        uint64_t sourceSize;     // custom_locales.json size when compiled
+        int64_t sourceMtime;     // and its modification time, for staleness checks
+        uint32_t checksum;       // FNV-1a over entries and pool
+        uint32_t revision;       // what else the entries were derived from; a mismatch is stale
+    };
+    
+    struct Entry {
+        uint32_t fields[FieldCount][2];   // offset, length into the pool
+        int32_t countryCode;
+        uint32_t reserved;
+    };
+    
+    static_assert(sizeof(Header) == 48, "catalog header layout");
+    static_assert(sizeof(Entry) == 88, "catalog entry layout");
+    
+private:
+    static constexpr uint16_t kVersion = 1;
+    
+    MappedFile file;
+    const Header* header = nullptr;
+    const Entry* entries = nullptr;
+    const char* pool = nullptr;
+    
+    string_view field(const Entry& entry, Field which) const {
+        return string_view(pool + entry.fields[which][0], entry.fields[which][1]);
+    }
+    
+    static size_t align8(size_t value) { return (value + 7) & ~static_cast<size_t>(7); }
+    
+public:
+    // Size and mtime of a catalog source file, (0, 0) when it does not exist
+    static pair<uint64_t, int64_t> sourceStamp(const string& path) {
+        error_code ec;
+        uint64_t size = fs::file_size(path, ec);
+        if (ec) return {0, 0};
+        auto mtime = fs::last_write_time(path, ec);
+        if (ec) return {0, 0};
+        return {size, static_cast<int64_t>(mtime.time_since_epoch().count())};
+    }
+    
+    bool open(const string& path, const string& sourcePath, uint32_t revision = 0) {
+        close();
+        if (!file.open(path) || file.size() < sizeof(Header)) return false;
+        const Header* candidate = reinterpret_cast<const Header*>(file.data());
+        if (memcmp(candidate->magic, "RCAT", 4) != 0 || candidate->version != kVersion || candidate->fieldCount != FieldCount ||
+            candidate->entriesOffset < sizeof(Header) ||
+            candidate->entriesOffset + (uint64_t)candidate->entryCount * sizeof(Entry) > candidate->poolOffset ||
+            (uint64_t)candidate->poolOffset + candidate->poolSize > file.size()) {
+            close();
+            return false;
+        }
+        const uint8_t* body = file.data() + candidate->entriesOffset;
+        if (fnv1a32(body, candidate->poolOffset + candidate->poolSize - candidate->entriesOffset) != candidate->checksum) {
+            close();
+            return false;
+        }
+        auto stamp = sourceStamp(sourcePath);
+        if (stamp.first != candidate->sourceSize || stamp.second != candidate->sourceMtime || candidate->revision != revision) {
+            close();
+            return false;
+        }
+        
+        const Entry* table = reinterpret_cast<const Entry*>(body);
+        for (uint32_t i = 0; i < candidate->entryCount; i++) {
+            for (int f = 0; f < FieldCount; f++) {
+                if ((uint64_t)table[i].fields[f][0] + table[i].fields[f][1] >= candidate->poolSize) {
+                    close();
+                    return false;
+                }
+            }
+        }
+        header = candidate;
+        entries = table;
+        pool = reinterpret_cast<const char*>(file.data() + header->poolOffset);
+        return true;
+    }
+    
+    void close() {
+        file.close();
+        header = nullptr;
+        entries = nullptr;
+        pool = nullptr;
+    }
+    
+    bool isOpen() const { return header != nullptr; }
+    size_t size() const { return header ? header->entryCount : 0; }
+    
+    LocaleView view(size_t index) const {
+        const Entry& entry = entries[index];
+        LocaleView out;
+        out.tag = field(entry, Tag);
+        out.name = field(entry, Name);
+        out.country = field(entry, Country);
+        out.shortDate = field(entry, ShortDate);
+        out.longDate = field(entry, LongDate);
+        out.timeFormat = field(entry, TimeFormat);
+        out.currency = field(entry, Currency);
+        out.decimalSep = field(entry, DecimalSep);
+        out.thousandSep = field(entry, ThousandSep);
+        out.listSep = field(entry, ListSep);
+        out.countryCode = entry.countryCode;
+        return out;
+    }
+    
+    // Binary search over the sorted table; no allocation
+    bool find(string_view tag, LocaleView& out) const {
+        if (!isOpen()) return false;
+        size_t low = 0, high = header->entryCount;
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            int order = field(entries[mid], Tag).compare(tag);
+            if (order == 0) {
+                out = view(mid);
+                return true;
+            }
+            if (order < 0) low = mid + 1;
+            else high = mid;
+        }
+        return false;
+    }
+    
+    // Build a catalog file from a tag-sorted locale list (--compile-catalog)
+    static bool compile(const vector<LocaleView>& locales, const string& path, const string& sourcePath,
+                        uint32_t revision = 0) {
+        vector<Entry> table;
+        string strings;
+        auto intern = [&strings](string_view text, uint32_t* slot) {
+            slot[0] = static_cast<uint32_t>(strings.size());
+            slot[1] = static_cast<uint32_t>(text.size());
+            strings.append(text.data(), text.size());
+            strings.push_back('\0');
+        };
+        for (const auto& locale : locales) {
+            Entry entry;
+            memset(&entry, 0, sizeof(entry));
+            intern(locale.tag, entry.fields[Tag]);
+            intern(locale.name, entry.fields[Name]);
+            intern(locale.country, entry.fields[Country]);
+            intern(locale.shortDate, entry.fields[ShortDate]);
+            intern(locale.longDate, entry.fields[LongDate]);
+            intern(locale.timeFormat, entry.fields[TimeFormat]);
+            intern(locale.currency, entry.fields[Currency]);
+            intern(locale.decimalSep, entry.fields[DecimalSep]);
+            intern(locale.thousandSep, entry.fields[ThousandSep]);
+            intern(locale.listSep, entry.fields[ListSep]);
+            entry.countryCode = locale.countryCode;
+            table.push_back(entry);
+        }
+        
+        Header out;
+        memset(&out, 0, sizeof(out));
+        memcpy(out.magic, "RCAT", 4);
+        out.version = kVersion;
+        out.fieldCount = FieldCount;
+        out.entryCount = static_cast<uint32_t>(table.size());
+        out.entriesOffset = static_cast<uint32_t>(align8(sizeof(Header)));
+        out.poolOffset = static_cast<uint32_t>(align8(out.entriesOffset + table.size() * sizeof(Entry)));
+        out.poolSize = static_cast<uint32_t>(strings.size());
+        auto stamp = sourceStamp(sourcePath);
+        out.sourceSize = stamp.first;
+        out.sourceMtime = stamp.second;
+        out.revision = revision;
+        
+        vector<uint8_t> image(out.poolOffset + out.poolSize, 0);
+        if (!table.empty()) memcpy(image.data() + out.entriesOffset, table.data(), table.size() * sizeof(Entry));
+        memcpy(image.data() + out.poolOffset, strings.data(), strings.size());
+        out.checksum = fnv1a32(image.data() + out.entriesOffset, image.size() - out.entriesOffset);
+        memcpy(image.data(), &out, sizeof(out));
+        
+        string temp = path + ".tmp";
+        {
+            ofstream stream(temp, ios::binary | ios::trunc);
+            if (!stream.is_open()) return false;
+            stream.write(reinterpret_cast<const char*>(image.data()), image.size());
+            if (!stream.good()) return false;
+        }
+        error_code ec;
+        fs::rename(temp, path, ec);
+        return !ec;
+    }
+};
+
+// A source of locale data. Views returned by a provider stay valid while
+// their owner is held, or for the provider's lifetime when it is null.
+class LocaleProvider {
+public:
+    virtual ~LocaleProvider() = default;
+    virtual const char* name() const = 0;
+    virtual bool find(const string& tag, PinnedLocale& out) const = 0;
+    virtual vector<PinnedLocale> locales() const = 0;
+};
+
+// The constexpr table compiled into the binary
+class BuiltinLocaleProvider : public LocaleProvider {
+public:
+    const char* name() const override { return "builtin"; }
+    
+    bool find(const string& tag, PinnedLocale& out) const override {
+        const LocaleView* builtin = findBuiltinLocale(tag);
+        if (builtin == nullptr) return false;
+        out = PinnedLocale(*builtin);
+        return true;
+    }
+    
+    vector<PinnedLocale> locales() const override {
+        return vector<PinnedLocale>(begin(kBuiltinLocales), end(kBuiltinLocales));
+    }
+};
+
+// One load of the locale sources: the mapped catalog, or the
+// custom_locales.json overlay when there is no current catalog. Never
+// modified once published.
+struct LocaleTables {
+    LocaleCatalog catalog;
+    map<string, LocaleInfo> custom;
+};
+
+// Serves the published LocaleTables. A reload swaps in a new snapshot
+// without blocking lookups; every view handed out pins the snapshot it came
+// from, and a replaced one is freed when its last view is dropped.
+class CatalogLocaleProvider : public LocaleProvider {
+private:
+    shared_ptr<const LocaleTables> tables = make_shared<const LocaleTables>();
+    
+    shared_ptr<const LocaleTables> current() const { return atomic_load(&tables); }
+    
+public:
+    void publish(shared_ptr<const LocaleTables> next) {
+        atomic_store(&tables, move(next));
+    }
+    
+    bool catalogOpen() const { return current()->catalog.isOpen(); }
+    
+    const char* name() const override { return catalogOpen() ? "catalog" : "custom"; }
+    
+    bool find(const string& tag, PinnedLocale& out) const override {
+        shared_ptr<const LocaleTables> snapshot = current();
+        LocaleView view;
+        if (!snapshot->catalog.find(tag, view)) {
+            auto it = snapshot->custom.find(tag);
+            if (it == snapshot->custom.end()) return false;
+            view = LocaleView::of(it->first, it->second);
+        }
+        out = PinnedLocale(view, move(snapshot));
+        return true;
+    }
+    
+    vector<PinnedLocale> locales() const override {
+        shared_ptr<const LocaleTables> snapshot = current();
+        vector<PinnedLocale> out;
+        out.reserve(snapshot->catalog.size() + snapshot->custom.size());
+        for (size_t i = 0; i < snapshot->catalog.size(); i++) out.emplace_back(snapshot->catalog.view(i), snapshot);
+        for (const auto& kv : snapshot->custom) out.emplace_back(LocaleView::of(kv.first, kv.second), snapshot);
+        return out;
+    }
+};
+
+// Every specific locale the OS knows (EnumSystemLocalesEx + GetLocaleInfoEx).
+// The first run derives locales on demand and writes all of them to a
+// catalog file on a background thread; later runs map that file, so a
+// lookup never reaches the NLS API. The cache is stamped with locale.nls
+// and rebuilt after an OS update changes it. Empty on non-Windows builds.
+class SystemLocaleProvider : public LocaleProvider {
+private:
+    LocaleCatalog cache;
+    mutable mutex derivedMutex;
+    mutable map<string, LocaleInfo> derived;    // views point into these nodes
+    thread prefetcher;
+    
+    // Bump when derive() changes what it reads, so caches from older builds
+    // are rebuilt. 1: system defaults only, never the user's overrides.
+    static constexpr uint32_t kCacheRevision = 1;
+    
+    // Build a LocaleInfo from the OS locale database
+    static bool derive(const string& tag, LocaleInfo& out) {
+#ifdef _WIN32
+        u16string wideTag = utf8ToUtf16(tag);
+        LPCWSTR name = reinterpret_cast<LPCWSTR>(wideTag.c_str());
+        if (!IsValidLocaleName(name)) return false;
+        // The locale's own defaults, not whatever the current user customized
+        auto text = [name](LCTYPE type, string& field) {
+            WCHAR buffer[128];
+            int length = GetLocaleInfoEx(name, type | LOCALE_NOUSEROVERRIDE, buffer, 128);
+            if (length <= 1) return false;
+            field = utf16ToUtf8(reinterpret_cast<const char16_t*>(buffer), static_cast<size_t>(length - 1));
+            return true;
+        };
+        bool ok = text(LOCALE_SENGLISHDISPLAYNAME, out.name) &&
+                  text(LOCALE_SENGLISHCOUNTRYNAME, out.country) &&
+                  text(LOCALE_SSHORTDATE, out.shortDate) &&
+                  text(LOCALE_SLONGDATE, out.longDate) &&
+                  text(LOCALE_STIMEFORMAT, out.timeFormat) &&
+                  text(LOCALE_SCURRENCY, out.currency) &&
+                  text(LOCALE_SDECIMAL, out.decimalSep) &&
+                  text(LOCALE_STHOUSAND, out.thousandSep) &&
+                  text(LOCALE_SLIST, out.listSep);
+        DWORD country = 0;
+        if (GetLocaleInfoEx(name, LOCALE_ICOUNTRY | LOCALE_RETURN_NUMBER | LOCALE_NOUSEROVERRIDE, reinterpret_cast<LPWSTR>(&country),
+                            sizeof(country) / sizeof(WCHAR)) > 0) {
+            out.countryCode = static_cast<int>(country);
+        }
+        return ok;
+#else
+        (void)tag;
+        (void)out;
+        return false;
+#endif
+    }
+    
+#ifdef _WIN32
+    static BOOL CALLBACK collectTag(LPWSTR name, DWORD, LPARAM param) {
+        auto* out = reinterpret_cast<vector<string>*>(param);
+        const char16_t* wide = reinterpret_cast<const char16_t*>(name);
+        out->push_back(utf16ToUtf8(wide, char_traits<char16_t>::length(wide)));
+        return TRUE;
+    }
+#endif
+    
+    // Tags of every specific (language-region) locale installed
+    static vector<string> systemTags() {
+        vector<string> tags;
+#ifdef _WIN32
+        EnumSystemLocalesEx(collectTag, LOCALE_SPECIFICDATA, reinterpret_cast<LPARAM>(&tags), NULL);
+#endif
+        return tags;
+    }
+    
+    // Changes whenever Windows updates its locale data
+    static string sourcePath() {
+#ifdef _WIN32
+        const char* root = getenv("SystemRoot");
+        return string(root != nullptr ? root : "C:\\Windows") + "\\System32\\locale.nls";
+#else
+        return string();
+#endif
+    }
+    
+public:
+    SystemLocaleProvider() = default;
+    SystemLocaleProvider(const SystemLocaleProvider&) = delete;
+    SystemLocaleProvider& operator=(const SystemLocaleProvider&) = delete;
+    
+    ~SystemLocaleProvider() {
+        wait();
+    }
+    
+    const char* name() const override { return cache.isOpen() ? "system cache" : "system"; }
+    
+    // Map the cache written by an earlier run; false when missing or stale
+    bool open(const string& cachePath) {
+        return !cachePath.empty() && cache.open(cachePath, sourcePath(), kCacheRevision);
+    }
+    
+    bool isCached() const { return cache.isOpen(); }
+    size_t cachedCount() const { return cache.size(); }
+    
+    // The cache and derived entries live as long as the provider: no owner
+    bool find(const string& tag, PinnedLocale& out) const override {
+        LocaleView cached;
+        if (cache.find(tag, cached)) {
+            out = PinnedLocale(cached);
+            return true;
+        }
+        lock_guard<mutex> lock(derivedMutex);
+        auto it = derived.find(tag);
+        if (it == derived.end()) {
+            LocaleInfo info;
+            if (!derive(tag, info)) return false;
+            it = derived.emplace(tag, info).first;
+        }
+        out = PinnedLocale(LocaleView::of(it->first, it->second));
+        return true;
+    }
+    
+    // Only the cached set: enumerating the OS here would put every NLS
+    // call back on the caller's path
+    vector<PinnedLocale> locales() const override {
+        vector<PinnedLocale> out;
+        out.reserve(cache.size());
+        for (size_t i = 0; i < cache.size(); i++) out.emplace_back(cache.view(i));
+        return out;
+    }
+    
+    // Enumerate and derive every OS locale off the caller's thread and
+    // compile them into cachePath. Returns false when there is no OS source.
+    bool prefetch(const string& cachePath, Logger& logger) {
+#ifdef _WIN32
+        if (cachePath.empty() || prefetcher.joinable()) return false;
+        prefetcher = thread([cachePath, &logger] {
+            auto begin = chrono::steady_clock::now();
+            map<string, LocaleInfo> all;
+            for (const auto& tag : systemTags()) {
+                LocaleInfo info;
+                if (derive(tag, info)) all.emplace(tag, info);
+            }
+            vector<LocaleView> views;
+            views.reserve(all.size());
+            for (const auto& kv : all) views.push_back(LocaleView::of(kv.first, kv.second));
+            if (!LocaleCatalog::compile(views, cachePath, sourcePath(), kCacheRevision)) {
+                logger.warn("Failed to write the OS locale cache: {}", cachePath);
+                return;
+            }
+            logger.info("Cached {} OS locales in {} ({} ms)", views.size(), cachePath,
+                        chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count());
+        });
+        return true;
+#else
+        (void)cachePath;
+        (void)logger;
+        return false;
+#endif
+    }
+    
+    void wait() {
+        if (prefetcher.joinable()) prefetcher.join();
+    }
+};
+
+// Maps free-form locale tags from feeds and manifests (de, de_AT, EN-us,
+// pt_BR.UTF-8) onto a locale the tool can apply. Tags are normalized to
+// BCP-47 casing, then tried exactly, looked up in the OS locale data, and
+// finally walked up their fallback chain (de-AT -> de -> de-DE). Every
+// outcome, including misses, is memoized, so a manifest with thousands of
+// rows resolves each distinct tag only once.
+class LocaleResolver {
+public:
+    using Lookup = function<bool(const string& tag, PinnedLocale& out)>;
+    using Known = function<vector<PinnedLocale>()>;
+    
+    struct Resolution {
+        bool found = false;
+        string tag;             // the locale actually applied
+        PinnedLocale view;      // pins its source until the resolution is dropped
+        const char* via = "";   // exact, normalized, system or fallback
+    };
+    
+private:
+    // Default region for a bare language where it is not simply xx-XX
+    struct LikelyRegion {
+        const char* language;
+        const char* region;
+    };
+    static constexpr LikelyRegion kLikelyRegions[] = {
+        {"en", "US"}, {"ja", "JP"}, {"ko", "KR"}, {"zh", "CN"}, {"pt", "BR"}, {"sv", "SE"},
+        {"da", "DK"}, {"nb", "NO"}, {"cs", "CZ"}, {"el", "GR"}, {"uk", "UA"}, {"he", "IL"},
+        {"hi", "IN"}, {"ar", "SA"}, {"vi", "VN"}, {"sl", "SI"}, {"et", "EE"}, {"ca", "ES"},
+    };
+    
+    Lookup lookup;
+    Known known;           // every applicable locale, for fallbacks and hints
+    Lookup system;         // OS locale data
+    mutable mutex cacheMutex;
+    unordered_map<string, Resolution> cache;
+    
+    static bool isAlpha(const string& part) {
+        return all_of(part.begin(), part.end(), [](char c) { return isalpha(static_cast<unsigned char>(c)) != 0; });
+    }
+    
+    static bool isDigits(const string& part) {
+        return all_of(part.begin(), part.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)) != 0; });
+    }
+    
+    static string language(const string& normalized) {
+        return normalized.substr(0, normalized.find('-'));
+    }
+    
+    static bool hasRegion(const string& normalized) {
+        size_t last = normalized.rfind('-');
+        if (last == string::npos) return false;
+        string part = normalized.substr(last + 1);
+        return (part.size() == 2 && isAlpha(part)) || (part.size() == 3 && isDigits(part));
+    }
+    
+    static size_t editDistance(const string& a, const string& b) {
+        vector<size_t> row(b.size() + 1);
+        for (size_t j = 0; j <= b.size(); j++) row[j] = j;
+        for (size_t i = 1; i <= a.size(); i++) {
+            size_t diagonal = row[0];
+            row[0] = i;
+            for (size_t j = 1; j <= b.size(); j++) {
+                size_t above = row[j];
+                bool same = tolower(static_cast<unsigned char>(a[i - 1])) == tolower(static_cast<unsigned char>(b[j - 1]));
+                row[j] = min({row[j] + 1, row[j - 1] + 1, diagonal + (same ? 0 : 1)});
+                diagonal = above;
+            }
+        }
+        return row[b.size()];
+    }
+    
+    // Candidate tags for a normalized request, most specific first
+    vector<string> candidates(const string& normalized) const {
+        vector<string> chain = fallbackChain(normalized);
+        string lang = language(normalized);
+        for (const auto& likely : kLikelyRegions) {
+            if (lang == likely.language) chain.push_back(lang + "-" + likely.region);
+        }
+        string upper;
+        for (char c : lang) upper += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        chain.push_back(lang + "-" + upper);
+        for (const auto& locale : known()) {
+            string tag(locale.tag);
+            if (tag.compare(0, lang.size() + 1, lang + "-") == 0) chain.push_back(tag);
+        }
+        return chain;
+    }
+    
+    // Caller holds cacheMutex
+    Resolution resolveLocked(const string& requested) {
+        Resolution resolution;
+        if (lookup(requested, resolution.view)) {
+            resolution.found = true;
+            resolution.tag = requested;
+            resolution.via = "exact";
+            return resolution;
+        }
+        string normalized = normalize(requested);
+        if (normalized.empty()) return resolution;
+        if (lookup(normalized, resolution.view)) {
+            resolution.found = true;
+            resolution.tag = normalized;
+            resolution.via = "normalized";
+            return resolution;
+        }
+        
+        // A specific locale the table lacks is better served by the OS than by a sibling
+        if (hasRegion(normalized) && system && system(normalized, resolution.view)) {
+            resolution.found = true;
+            resolution.tag = normalized;
+            resolution.via = "system";
+            return resolution;
+        }
+        
+        for (const auto& candidate : candidates(normalized)) {
+            if (lookup(candidate, resolution.view)) {
+                resolution.found = true;
+                resolution.tag = candidate;
+                resolution.via = "fallback";
+                return resolution;
+            }
+        }
+        return resolution;
+    }
+    
+public:
+    LocaleResolver(Lookup lookup, Known known, Lookup system = nullptr)
+        : lookup(move(lookup)), known(move(known)), system(move(system)) {}
+    
+    // BCP-47 casing and separators: "pt_br.UTF-8" -> "pt-BR", "zh-hans-cn" -> "zh-Hans-CN"
+    static string normalize(const string& requested) {
+        string tag = requested;
+        size_t start = tag.find_first_not_of(" \t");
+        if (start == string::npos) return string();
+        tag = tag.substr(start, tag.find_last_not_of(" \t") - start + 1);
+        tag = tag.substr(0, tag.find_first_of(".@"));    // POSIX charset and modifier
+        replace(tag.begin(), tag.end(), '_', '-');
+        
+        string out;
+        stringstream parts(tag);
+        string part;
+        for (size_t index = 0; getline(parts, part, '-'); index++) {
+            if (part.empty()) return string();
+            for (char& c : part) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            if (index > 0 && part.size() == 2 && isAlpha(part)) {
+                for (char& c : part) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+            } else if (index > 0 && part.size() == 4 && isAlpha(part)) {
+                part[0] = static_cast<char>(toupper(static_cast<unsigned char>(part[0])));
+            }
+            out += (index > 0 ? "-" : "") + part;
+        }
+        return isAlpha(language(out)) ? out : string();
+    }
+    
+    // The tag and each parent formed by dropping the last subtag
+    static vector<string> fallbackChain(const string& normalized) {
+        vector<string> chain;
+        for (string tag = normalized; !tag.empty(); ) {
+            chain.push_back(tag);
+            size_t last = tag.rfind('-');
+            tag = last == string::npos ? string() : tag.substr(0, last);
+        }
+        return chain;
+    }
+    
+    Resolution resolve(const string& requested) {
+        lock_guard<mutex> lock(cacheMutex);
+        auto it = cache.find(requested);
+        if (it == cache.end()) it = cache.emplace(requested, resolveLocked(requested)).first;
+        return it->second;
+    }
+    
+    // Known tags closest to an unresolvable request: same language first,
+    // then by edit distance, for "did you mean" hints instead of the full list
+    vector<string> suggest(const string& requested, size_t limit = 3) const {
+        string normalized = normalize(requested);
+        string target = normalized.empty() ? requested : normalized;
+        vector<pair<size_t, string>> scored;
+        for (const auto& locale : known()) {
+            string tag(locale.tag);
+            size_t distance = language(tag) == language(target) ? 0 : editDistance(target, tag);
+            if (distance <= 2) scored.emplace_back(distance, tag);
+        }
+        sort(scored.begin(), scored.end());
+        vector<string> out;
+        for (size_t i = 0; i < scored.size() && i < limit; i++) out.push_back(scored[i].second);
+        return out;
+    }
+    
+    size_t cachedTags() const {
+        lock_guard<mutex> lock(cacheMutex);
+        return cache.size();
+    }
+    
+    // Forget every memoized outcome, after the locale sources were reloaded
+    void clear() {
+        lock_guard<mutex> lock(cacheMutex);
+        cache.clear();
+    }
+};
+
+// Hive an apply is aimed at: the current user, or a user profile under HKEY_USERS
+struct RegistryTarget {
+    HKEY root;
+    string rootName;    // used in logs and .reg exports
+    string label;       // profile SID; empty for the current user
+    bool remote = false;    // reached through RegConnectRegistry; KTM cannot span it
+    
+    static RegistryTarget currentUser() {
+        return {HKEY_CURRENT_USER, "HKEY_CURRENT_USER", ""};
+    }
+};
+
+#ifdef _WIN32
+// RAII wrapper for registry key
+class RegistryKeyGuard {
+private:
+    HKEY hKey;
+    bool valid;
+public:
+    RegistryKeyGuard() : hKey(NULL), valid(false) {}
+    
+    // Create or open the key for writing. Returns the Win32 status, so
+    // callers can tell a locked hive from a missing path
+    LONG open(HKEY root, const string& key, REGSAM access = KEY_SET_VALUE) {
+        u16string wideKey = utf8ToUtf16(key);
+        LONG result = RegCreateKeyExW(root, reinterpret_cast<LPCWSTR>(wideKey.c_str()), 0, NULL, 0, access, NULL, &hKey, NULL);
+        valid = (result == ERROR_SUCCESS);
+        return result;
+    }
+    
+    // Open the key as part of a KTM transaction; writes through it only
+    // become visible when the transaction commits
+    LONG openTransacted(HKEY root, const string& key, HANDLE transaction, REGSAM access = KEY_SET_VALUE) {
+        u16string wideKey = utf8ToUtf16(key);
+        LONG result = RegCreateKeyTransactedW(root, reinterpret_cast<LPCWSTR>(wideKey.c_str()), 0, NULL, 0, access, NULL,
+                                              &hKey, NULL, transaction, NULL);
+        valid = (result == ERROR_SUCCESS);
+        return result;
+    }
+    
+    // Open an existing key for reading through the wide API
+    bool openForRead(HKEY root, const string& key, REGSAM access = KEY_READ) {
+        u16string wideKey = utf8ToUtf16(key);
+        LONG result = RegOpenKeyExW(root, reinterpret_cast<LPCWSTR>(wideKey.c_str()), 0, access, &hKey);
+        valid = (result == ERROR_SUCCESS);
+        return valid;
+    }
+    
+    HKEY get() const { return hKey; }
+    bool isValid() const { return valid; }
+    
+    ~RegistryKeyGuard() {
+        if (valid && hKey != NULL) {
+            RegCloseKey(hKey);
+        }
+    }
+    
+    // Prevent copying
+    RegistryKeyGuard(const RegistryKeyGuard&) = delete;
+    RegistryKeyGuard& operator=(const RegistryKeyGuard&) = delete;
+};
+
+// RAII wrapper for a Kernel Transaction Manager transaction. ktmw32.dll is
+// loaded on demand so the binary still starts where KTM is unavailable.
+class KtmTransaction {
+private:
+    typedef HANDLE (WINAPI *CreateTransactionFn)(LPSECURITY_ATTRIBUTES, LPVOID, DWORD, DWORD, DWORD, DWORD, LPWSTR);
+    typedef BOOL (WINAPI *FinishTransactionFn)(HANDLE);
+    
+    HANDLE handle;
+    bool finished;
+    
+    static HMODULE library() {
+        static HMODULE module = LoadLibraryA("ktmw32.dll");
+        return module;
+    }
+    
+    static void* entry(const char* name) {
+        HMODULE module = library();
+        return module != NULL ? reinterpret_cast<void*>(GetProcAddress(module, name)) : NULL;
+    }
+    
+public:
+    KtmTransaction() : handle(INVALID_HANDLE_VALUE), finished(false) {}
+    
+    bool begin(DWORD timeoutMs = 5000) {
+        auto create = reinterpret_cast<CreateTransactionFn>(entry("CreateTransaction"));
+        if (create == NULL) return false;
+        handle = create(NULL, NULL, 0, 0, 0, timeoutMs, NULL);
+        return handle != INVALID_HANDLE_VALUE;
+    }
+    
+    bool commit() {
+        auto commitFn = reinterpret_cast<FinishTransactionFn>(entry("CommitTransaction"));
+        finished = true;
+        return commitFn != NULL && commitFn(handle);
+    }
+    
+    bool rollback() {
+        auto rollbackFn = reinterpret_cast<FinishTransactionFn>(entry("RollbackTransaction"));
+        finished = true;
+        return rollbackFn != NULL && rollbackFn(handle);
+    }
+    
+    HANDLE get() const { return handle; }
+    bool isActive() const { return handle != INVALID_HANDLE_VALUE && !finished; }
+    
+    ~KtmTransaction() {
+        if (handle == INVALID_HANDLE_VALUE) return;
+        if (!finished) rollback();
+        CloseHandle(handle);
+    }
+    
+    KtmTransaction(const KtmTransaction&) = delete;
+    KtmTransaction& operator=(const KtmTransaction&) = delete;
+};
+#endif
+
+// Scratch memory for one apply's transient state. Allocations bump a pointer
+// through an inline buffer, spilling to the heap only if it runs out, and
+// are never freed one by one: the Scope that owns an apply rewinds the whole
+// arena when it ends. Each thread has its own, so workers never contend.
+class ApplyArena : public pmr::memory_resource {
+private:
+    static constexpr size_t kInlineBytes = 16 * 1024;
+    alignas(max_align_t) unsigned char buffer[kInlineBytes];
+    pmr::monotonic_buffer_resource monotonic;
+    size_t bytes = 0;
+    size_t allocations = 0;
+    bool inUse = false;
+    
+    void* do_allocate(size_t size, size_t alignment) override {
+        bytes += size;
+        allocations++;
+        return monotonic.allocate(size, alignment);
+    }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+    
+public:
+    ApplyArena() : monotonic(buffer, sizeof(buffer), pmr::new_delete_resource()) {}
+    ApplyArena(const ApplyArena&) = delete;
+    ApplyArena& operator=(const ApplyArena&) = delete;
+    
+    static ApplyArena& forThread() {
+        thread_local ApplyArena arena;
+        return arena;
+    }
+    
+    size_t bytesAllocated() const { return bytes; }
+    size_t allocationCount() const { return allocations; }
+    
+    // Rewinds to the inline buffer; O(1) unless an apply spilled past it
+    void reset() {
+        monotonic.release();
+        bytes = 0;
+        allocations = 0;
+    }
+    
+    // One apply's lifetime on this thread's arena. A nested Scope (an apply
+    // inside an apply) falls back to the heap instead of rewinding the
+    // outer one's memory.
+    class Scope {
+    private:
+        ApplyArena& arena;
+        bool owner;
+        const char* label;
+        
+    public:
+        explicit Scope(const char* label) : arena(forThread()), owner(!arena.inUse), label(label) {
+            arena.inUse = true;
+        }
+        ~Scope() {
+            if (!owner) return;
+            MetricsRegistry::instance().count(MetricsRegistry::ArenaBytes, label, arena.bytesAllocated());
+            arena.reset();
+            arena.inUse = false;
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        
+        pmr::memory_resource* resource() { return owner ? static_cast<pmr::memory_resource*>(&arena) : pmr::new_delete_resource(); }
+        size_t bytesAllocated() const { return owner ? arena.bytesAllocated() : 0; }
+    };
+};
+
+// Arena for a pipeline job, whose stages run on different threads and so
+// cannot use the per-thread one. Heap-backed (a queued job holds no inline
+// buffer) and reported under the same metric when the job is freed.
+class JobArena : public pmr::memory_resource {
+private:
+    pmr::monotonic_buffer_resource monotonic;
+    size_t bytes = 0;
+    const char* label;
+    
+    void* do_allocate(size_t size, size_t alignment) override {
+        bytes += size;
+        return monotonic.allocate(size, alignment);
+    }
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override { return this == &other; }
+    
+public:
+    explicit JobArena(const char* label) : label(label) {}
+    ~JobArena() override {
+        if (bytes > 0) MetricsRegistry::instance().count(MetricsRegistry::ArenaBytes, label, bytes);
+    }
+    JobArena(const JobArena&) = delete;
+    JobArena& operator=(const JobArena&) = delete;
+    
+    size_t bytesAllocated() const { return bytes; }
+};
+
+// Which registry failures are worth another attempt, and how long to wait
+// first. Hives held briefly by the profile service, antivirus or a backup
+// agent fail with sharing/lock errors that clear on their own; a bad value
+// or a missing hive does not.
+struct RetryPolicy {
+    int maxRetries = 3;
+    chrono::milliseconds base{200};
+    chrono::milliseconds cap{5000};
+    
+    static bool isTransient(LONG status) {
+        static const LONG transient[] = {
+            5,      // ERROR_ACCESS_DENIED (hive held exclusively)
+            21,     // ERROR_NOT_READY
+            32,     // ERROR_SHARING_VIOLATION
+            33,     // ERROR_LOCK_VIOLATION
+            170,    // ERROR_BUSY
+            1237,   // ERROR_RETRY
+            1450,   // ERROR_NO_SYSTEM_RESOURCES
+            1460,   // ERROR_TIMEOUT
+        };
+        return find(begin(transient), end(transient), status) != end(transient);
+    }
+    
+    // Exponential backoff with jitter: base * 2^attempt, capped, then scaled
+    // into [50%, 100%] so profiles that failed together do not retry together
+    chrono::milliseconds delay(int attempt) const {
+        long long ceiling = base.count() << min(attempt, 20);
+        ceiling = min<long long>(ceiling, cap.count());
+        thread_local mt19937 rng(random_device{}());
+        uniform_int_distribution<long long> jitter(ceiling / 2, ceiling);
+        return chrono::milliseconds(jitter(rng));
+    }
+};
+
+// One queued value write. REG_SZ/REG_DWORD values carry their text form in
+// data; raw writes carry the exact bytes captured from a snapshot.
+struct RegistryWrite {
+    string valueName;
+    string data;
+    DWORD type;
+    bool raw;              // data lives in rawData, written verbatim
+    vector<uint8_t> rawData;
+    // Filled by RegistryBatch::encode() so RegSetValueExW needs no conversion
+    u16string wideName;
+    vector<uint8_t> wire;  // value bytes as RegSetValueExW takes them
+};
+
+struct RegistrySnapshot;
+
+// Storage the batch and diff engines run against. The Win32 backend is the
+// real registry; the in-memory mock lets benchmarks and demo mode drive the
+// same apply path without touching a hive.
+class IRegistryBackend {
+public:
+    // One apply's worth of key handles, optionally inside a transaction.
+    // Sessions are used by a single thread; the backend itself is shared.
+    class Session {
+    public:
+        virtual ~Session() = default;
+        virtual bool transacted() const = 0;
+        virtual LONG openKey(const string& keyPath) = 0;
+        virtual LONG setValue(const string& keyPath, const RegistryWrite& write, Logger& logger) = 0;
+        virtual bool commit() = 0;
+        virtual void rollback() = 0;
+    };
+    
+    virtual ~IRegistryBackend() = default;
+    virtual const char* name() const = 0;
+    virtual unique_ptr<Session> open(HKEY root, bool transactional) = 0;
+    // Single-level read of one key's values, as used by the diff engine
+    virtual bool readValues(HKEY root, const string& keyPath, RegistrySnapshot& snapshot) = 0;
+};
+
+IRegistryBackend& defaultRegistryBackend();
+
+// Collects registry writes grouped by key path so each key is opened once
+// per apply. With transactions enabled the whole batch commits or rolls back.
+class RegistryBatch {
+public:
+    using Write = RegistryWrite;
+    
+    struct Result {
+        size_t applied = 0;
+        size_t failed = 0;
+        bool rolledBack = false;
+        bool transient = false;    // every failure was one RetryPolicy would retry
+    };
+    
+private:
+    vector<pair<string, vector<Write>>> keys;
+    size_t writeCount = 0;
+    
+public:
+    void set(const string& keyPath, const string& valueName, string_view data, DWORD type = REG_SZ) {
+        Write write;
+        write.valueName = valueName;
+        write.data = string(data);
+        write.type = type;
+        write.raw = false;
+        add(keyPath, write);
+    }
+    
+    // Queue a value exactly as captured in a snapshot (type and bytes as-is)
+    void setRaw(const string& keyPath, const string& valueName, DWORD type, const vector<uint8_t>& bytes) {
+        Write write;
+        write.valueName = valueName;
+        write.type = type;
+        write.raw = true;
+        write.rawData = bytes;
+        add(keyPath, write);
+    }
+    
+    // Human-readable value for logs and demo output
+    static string describe(const Write& write) {
+        if (!write.raw) return write.data;
+        if (write.type == REG_SZ || write.type == REG_EXPAND_SZ) {
+            return registryStringToUtf8(write.rawData);
+        }
+        if (write.type == REG_DWORD && write.rawData.size() == 4) {
+            uint32_t value = write.rawData[0] | (write.rawData[1] << 8) | (write.rawData[2] << 16) | ((uint32_t)write.rawData[3] << 24);
+            return to_string(value);
+        }
+        return "<" + to_string(write.rawData.size()) + " bytes>";
+    }
+    
+    // Queue a write as-is, keeping any pre-encoded forms it carries
+    void add(const string& keyPath, const Write& write) {
+        auto it = find_if(keys.begin(), keys.end(), [&](const pair<string, vector<Write>>& entry) {
+            return entry.first == keyPath;
+        });
+        if (it == keys.end()) {
+            keys.emplace_back(keyPath, vector<Write>());
+            it = keys.end() - 1;
+        }
+        it->second.push_back(write);
+        writeCount++;
+    }
+    
+    // The bytes a write stores: captured bytes for raw writes, the cached wire
+    // form when encode() ran, otherwise converted into scratch. Null when the
+    // text cannot be encoded for its type.
+    static const vector<uint8_t>* valueBytes(const Write& write, vector<uint8_t>& scratch) {
+        if (write.raw) return &write.rawData;
+        if (!write.wire.empty()) return &write.wire;
+        if (write.type == REG_SZ) {
+            scratch = utf8ToRegistryString(write.data);
+            return &scratch;
+        }
+        if (write.type == REG_DWORD) {
+            try {
+                uint32_t value = static_cast<uint32_t>(stoul(write.data));
+                scratch = {static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+                           static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)};
+                return &scratch;
+            } catch (const exception&) {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+    
+    static string encodeError(const Write& write) {
+        return write.type == REG_DWORD ? "Invalid DWORD value: " + write.data
+                                       : "Unsupported registry type: " + to_string(write.type);
+    }
+    
+    // Pre-encode every value name and value to UTF-16 once, so the batch can
+    // be applied any number of times without a conversion per write
+    void encode() {
+        for (auto& key : keys) {
+            for (auto& write : key.second) {
+                write.wideName = utf8ToUtf16(write.valueName);
+                vector<uint8_t> scratch;
+                if (!write.raw && write.wire.empty() && valueBytes(write, scratch) == &scratch) {
+                    write.wire = move(scratch);
+                }
+            }
+        }
+    }
+    
+    const vector<pair<string, vector<Write>>>& entries() const { return keys; }
+    size_t size() const { return writeCount; }
+    bool empty() const { return writeCount == 0; }
+    
+    // Entries either own their key path and writes or point at them
+    // (RegistryBatchView); the apply and diff loops take both
+    template <typename T> static const T& deref(const T& value) { return value; }
+    template <typename T> static const T& deref(const T* value) { return *value; }
+    
+    Result apply(Logger& logger, bool transactional = true, HKEY root = HKEY_CURRENT_USER,
+                 IRegistryBackend& backend = defaultRegistryBackend()) const {
+        return applyKeys(keys, writeCount, logger, transactional, root, backend);
+    }
+    
+    template <typename Keys>
+    static Result applyKeys(const Keys& keys, size_t writeCount, Logger& logger, bool transactional, HKEY root,
+                            IRegistryBackend& backend) {
+        Result result;
+        unique_ptr<IRegistryBackend::Session> session = backend.open(root, transactional);
+        if (transactional && !session->transacted()) {
+            logger.warn("Registry transactions unavailable, applying without rollback protection");
+        }
+        bool useTransaction = session->transacted();
+        bool allTransient = true;
+        
+        for (const auto& key : keys) {
+            const string& keyPath = deref(key.first);
+            LONG openStatus = session->openKey(keyPath);
+            if (openStatus != ERROR_SUCCESS) {
+                logger.error("Failed to open registry key: {} (Error: {})", keyPath, openStatus);
+                allTransient = allTransient && RetryPolicy::isTransient(openStatus);
+                result.failed += key.second.size();
+                if (useTransaction) break;
+                continue;
+            }
+            
+            for (const auto& entry : key.second) {
+                const Write& write = deref(entry);
+                auto started = chrono::steady_clock::now();
+                LONG status = session->setValue(keyPath, write, logger);
+                MetricsRegistry::instance().observe(MetricsRegistry::ValueWriteDuration, write.valueName,
+                    chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started));
+                if (status == ERROR_SUCCESS) {
+                    logger.debug("Set registry: {}\\{} = {}", keyPath, write.valueName, [&] { return describe(write); });
+                    result.applied++;
+                } else {
+                    logger.error("Failed to set registry value: {}\\{} (Error: {})", keyPath, write.valueName, status);
+                    allTransient = allTransient && RetryPolicy::isTransient(status);
+                    result.failed++;
+                    if (useTransaction) break;
+                }
+            }
+            if (useTransaction && result.failed > 0) break;
+        }
+        
+        if (useTransaction && !(result.failed == 0 && session->commit())) {
+            session->rollback();
+            logger.warn("Registry transaction rolled back, no values were changed");
+            result.failed = writeCount;
+            result.applied = 0;
+            result.rolledBack = true;
+        }
+        // A failed commit with no write errors is a conflict; worth retrying
+        result.transient = result.failed > 0 && allTransient;
+        MetricsRegistry::instance().count(MetricsRegistry::RegistryWrites, "applied", result.applied);
+        MetricsRegistry::instance().count(MetricsRegistry::RegistryWrites, "failed", result.failed);
+        return result;
+    }
+};
+
+// A subset of a RegistryBatch that borrows from it: key paths and writes
+// are pointers into the source batch and the containers live in an
+// ApplyArena, so narrowing a cached batch down to what differs copies no
+// strings. The source batch must outlive the view.
+class RegistryBatchView {
+public:
+    using Write = RegistryWrite;
+    using Entry = pair<const string*, pmr::vector<const Write*>>;
+    
+private:
+    pmr::vector<Entry> keys;
+    size_t writeCount = 0;
+    
+public:
+    explicit RegistryBatchView(pmr::memory_resource* arena) : keys(arena) {}
+    
+    void add(const string& keyPath, const Write& write) {
+        if (keys.empty() || keys.back().first != &keyPath) {
+            keys.emplace_back();
+            keys.back().first = &keyPath;
+        }
+        keys.back().second.push_back(&write);
+        writeCount++;
+    }
+    
+    void addAll(const RegistryBatch& batch) {
+        for (const auto& key : batch.entries()) {
+            for (const auto& write : key.second) add(key.first, write);
+        }
+    }
+    
+    const pmr::vector<Entry>& entries() const { return keys; }
+    size_t size() const { return writeCount; }
+    bool empty() const { return writeCount == 0; }
+    
+    RegistryBatch::Result apply(Logger& logger, bool transactional = true, HKEY root = HKEY_CURRENT_USER,
+                                IRegistryBackend& backend = defaultRegistryBackend()) const {
+        return RegistryBatch::applyKeys(keys, writeCount, logger, transactional, root, backend);
+    }
+};
+
+// In-memory copy of a registry key tree, captured without spawning reg.exe.
+// A value of kAbsentType is a tombstone: it did not exist when captured, so
+// restoring the snapshot deletes it.
+struct RegistrySnapshot {
+    static constexpr DWORD kAbsentType = 0xFFFFFFFE;
+    
+    struct Value {
+        string name;
+        DWORD type;
+        vector<uint8_t> data;
+        
+        bool absent() const { return type == kAbsentType; }
+    };
+    struct Key {
+        string path;            // relative to the hive root
+        vector<Value> values;
+    };
+    
+    int64_t capturedAt = 0;
+    vector<Key> keys;           // keys[0] is the captured key, subkeys follow depth-first
+    
+    size_t valueCount() const {
+        size_t count = 0;
+        for (const auto& key : keys) count += key.values.size();
+        return count;
+    }
+};
+
+// Native backup engine: captures snapshots through the registry API and
+// persists them in a compact binary format, with optional .reg text export.
+//
+// Binary layout (little-endian):
+//   "RSNP" u16 version u16 reserved i64 capturedAt u32 keyCount
+//   per key:   u16 pathLen path u32 valueCount
+//   per value: u16 nameLen name u32 type u32 dataLen data
+//   u32 FNV-1a checksum of everything before it
+// Version 2 adds tombstones (type kAbsentType, no data); version 1 files
+// still load.
+class NativeBackup {
+private:
+    static constexpr uint16_t kFormatVersion = 2;
+    
+    static uint32_t checksum(const uint8_t* data, size_t size) {
+        return fnv1a32(data, size);
+    }
+    
+    static void putU16(vector<uint8_t>& out, uint16_t v) {
+        out.push_back(v & 0xFF);
+        out.push_back(v >> 8);
+    }
+    
+    static void putU32(vector<uint8_t>& out, uint32_t v) {
+        for (int i = 0; i < 4; i++) out.push_back((v >> (8 * i)) & 0xFF);
+    }
+    
+    static void putU64(vector<uint8_t>& out, uint64_t v) {
+        for (int i = 0; i < 8; i++) out.push_back((v >> (8 * i)) & 0xFF);
+    }
+    
+    static void putString(vector<uint8_t>& out, const string& text) {
+        putU16(out, static_cast<uint16_t>(text.size()));
+        out.insert(out.end(), text.begin(), text.end());
+    }
+    
+    // Bounds-checked cursor over a serialized snapshot
+    struct Reader {
+        const uint8_t* data;
+        size_t size;
+        size_t pos = 0;
+        bool ok = true;
+        
+        Reader(const uint8_t* d, size_t n) : data(d), size(n) {}
+        
+        bool need(size_t n) {
+            if (!ok || size - pos < n) ok = false;
+            return ok;
+        }
+        uint64_t uint(size_t bytes) {
+            if (!need(bytes)) return 0;
+            uint64_t v = 0;
+            for (size_t i = 0; i < bytes; i++) v |= (uint64_t)data[pos + i] << (8 * i);
+            pos += bytes;
+            return v;
+        }
+        string text() {
+            size_t length = static_cast<size_t>(uint(2));
+            if (!need(length)) return string();
+            string out(reinterpret_cast<const char*>(data + pos), length);
+            pos += length;
+            return out;
+        }
+        vector<uint8_t> bytes(size_t length) {
+            if (!need(length)) return {};
+            vector<uint8_t> out(data + pos, data + pos + length);
+            pos += length;
+            return out;
+        }
+    };
+    
+#ifdef _WIN32
+    static bool captureKey(HKEY root, const string& path, RegistrySnapshot& snapshot, bool recursive) {
+        RegistryKeyGuard keyGuard;
+        if (!keyGuard.openForRead(root, path)) return false;
+        return readKey(keyGuard.get(), root, path, snapshot, recursive);
+    }
+    
+    static bool readKey(HKEY handle, HKEY root, const string& path, RegistrySnapshot& snapshot, bool recursive) {
+        DWORD subKeyCount = 0, maxSubKeyLen = 0, valueCount = 0, maxNameLen = 0, maxDataLen = 0;
+        if (RegQueryInfoKeyW(handle, NULL, NULL, NULL, &subKeyCount, &maxSubKeyLen, NULL,
+                             &valueCount, &maxNameLen, &maxDataLen, NULL, NULL) != ERROR_SUCCESS) {
+            return false;
+        }
+        
+        RegistrySnapshot::Key key;
+        key.path = path;
+        key.values.reserve(valueCount);
+        
+        // Size the buffers once from RegQueryInfoKey instead of probing per value
+        vector<WCHAR> name(maxNameLen + 1);
+        vector<BYTE> data(maxDataLen + 1);
+        for (DWORD index = 0;; index++) {
+            DWORD nameLen = static_cast<DWORD>(name.size());
+            DWORD dataLen = static_cast<DWORD>(data.size());
+            DWORD type = 0;
+            LONG status = RegEnumValueW(handle, index, name.data(), &nameLen, NULL, &type, data.data(), &dataLen);
+            if (status == ERROR_NO_MORE_ITEMS) break;
+            if (status == ERROR_MORE_DATA) {
+                // Value grew since RegQueryInfoKey; retry this index with room for it
+                name.resize(name.size() * 2);
+                data.resize(dataLen > data.size() ? dataLen : data.size() * 2);
+                index--;
+                continue;
+            }
+            if (status != ERROR_SUCCESS) return false;
+            
+            RegistrySnapshot::Value value;
+            value.name = utf16ToUtf8(reinterpret_cast<const char16_t*>(name.data()), nameLen);
+            value.type = type;
+            value.data.assign(data.begin(), data.begin() + dataLen);
+            key.values.push_back(move(value));
+        }
+        snapshot.keys.push_back(move(key));
+        if (!recursive) return true;
+        
+        vector<WCHAR> subKey(maxSubKeyLen + 1);
+        vector<string> children;
+        for (DWORD index = 0;; index++) {
+            DWORD subKeyLen = static_cast<DWORD>(subKey.size());
+            LONG status = RegEnumKeyExW(handle, index, subKey.data(), &subKeyLen, NULL, NULL, NULL, NULL);
+            if (status == ERROR_NO_MORE_ITEMS) break;
+            if (status != ERROR_SUCCESS) return false;
+            children.push_back(path + "\\" + utf16ToUtf8(reinterpret_cast<const char16_t*>(subKey.data()), subKeyLen));
+        }
+        for (const auto& child : children) {
+            if (!captureKey(root, child, snapshot, true)) return false;
+        }
+        return true;
+    }
+#endif
+    
+    static string hexBytes(const vector<uint8_t>& data) {
+        static const char digits[] = "0123456789abcdef";
+        string out;
+        for (size_t i = 0; i < data.size(); i++) {
+            if (i > 0) out += ',';
+            out += digits[data[i] >> 4];
+            out += digits[data[i] & 0xF];
+        }
+        return out;
+    }
+    
+    static string escapeRegString(const string& text) {
+        string out;
+        for (char c : text) {
+            if (c == '\\' || c == '"') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+    
+public:
+#ifdef _WIN32
+    static bool capture(HKEY root, const string& keyPath, RegistrySnapshot& snapshot) {
+        snapshot.keys.clear();
+        snapshot.capturedAt = static_cast<int64_t>(time(nullptr));
+        return captureKey(root, keyPath, snapshot, true);
+    }
+    
+    // Single-pass read of one key's own values, used by the diff engine
+    static bool captureValues(HKEY root, const string& keyPath, RegistrySnapshot& snapshot) {
+        snapshot.keys.clear();
+        snapshot.capturedAt = static_cast<int64_t>(time(nullptr));
+        return captureKey(root, keyPath, snapshot, false);
+    }
+    
+    // captureValues through a handle the caller keeps open; keyPath only labels the result
+    static bool captureOpenValues(HKEY key, const string& keyPath, RegistrySnapshot& snapshot) {
+        snapshot.keys.clear();
+        snapshot.capturedAt = static_cast<int64_t>(time(nullptr));
+        return readKey(key, key, keyPath, snapshot, false);
+    }
+#endif
+    
+    static vector<uint8_t> serialize(const RegistrySnapshot& snapshot) {
+        vector<uint8_t> out;
+        out.reserve(64 + snapshot.valueCount() * 48);
+        out.insert(out.end(), {'R', 'S', 'N', 'P'});
+        putU16(out, kFormatVersion);
+        putU16(out, 0);
+        putU64(out, static_cast<uint64_t>(snapshot.capturedAt));
+        putU32(out, static_cast<uint32_t>(snapshot.keys.size()));
+        for (const auto& key : snapshot.keys) {
+            putString(out, key.path);
+            putU32(out, static_cast<uint32_t>(key.values.size()));
+            for (const auto& value : key.values) {
+                putString(out, value.name);
+                putU32(out, static_cast<uint32_t>(value.type));
+                putU32(out, static_cast<uint32_t>(value.data.size()));
+                out.insert(out.end(), value.data.begin(), value.data.end());
+            }
+        }
+        putU32(out, checksum(out.data(), out.size()));
+        return out;
+    }
+    
+    static bool deserialize(const uint8_t* data, size_t size, RegistrySnapshot& snapshot) {
+        if (size < 24 || memcmp(data, "RSNP", 4) != 0) return false;
+        Reader trailer(data + size - 4, 4);
+        if (trailer.uint(4) != checksum(data, size - 4)) return false;
+        
+        Reader reader(data + 4, size - 8);
+        uint64_t version = reader.uint(2);
+        if (version < 1 || version > kFormatVersion) return false;
+        reader.uint(2);
+        snapshot.capturedAt = static_cast<int64_t>(reader.uint(8));
+        snapshot.keys.clear();
+        uint32_t keyCount = static_cast<uint32_t>(reader.uint(4));
+        for (uint32_t k = 0; k < keyCount && reader.ok; k++) {
+            RegistrySnapshot::Key key;
+            key.path = reader.text();
+            uint32_t valueCount = static_cast<uint32_t>(reader.uint(4));
+            for (uint32_t v = 0; v < valueCount && reader.ok; v++) {
+                RegistrySnapshot::Value value;
+                value.name = reader.text();
+                value.type = static_cast<DWORD>(reader.uint(4));
+                value.data = reader.bytes(static_cast<size_t>(reader.uint(4)));
+                key.values.push_back(move(value));
+            }
+            snapshot.keys.push_back(move(key));
+        }
+        return reader.ok;
+    }
+    
+    static bool save(const RegistrySnapshot& snapshot, const string& file) {
+        vector<uint8_t> bytes = serialize(snapshot);
+        ofstream out(file, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        return out.good();
+    }
+    
+    // Mapped rather than streamed: restores decode straight from the page cache
+    static bool load(const string& file, RegistrySnapshot& snapshot) {
+        MappedFile mapped;
+        if (!mapped.open(file)) return false;
+        return deserialize(mapped.data(), mapped.size(), snapshot);
+    }
+    
+    // Optional slow path: regedit-compatible UTF-16LE .reg text
+    static bool exportRegText(const RegistrySnapshot& snapshot, const string& rootName, const string& file) {
+        string text = "Windows Registry Editor Version 5.00\r\n";
+        for (const auto& key : snapshot.keys) {
+            text += "\r\n[" + rootName + "\\" + key.path + "]\r\n";
+            for (const auto& value : key.values) {
+                text += value.name.empty() ? "@" : "\"" + escapeRegString(value.name) + "\"";
+                text += "=";
+                if (value.absent()) {
+                    text += "-";
+                } else if (value.type == REG_SZ) {
+                    text += "\"" + escapeRegString(registryStringToUtf8(value.data)) + "\"";
+                } else if (value.type == REG_DWORD && value.data.size() == 4) {
+                    uint32_t dword = value.data[0] | (value.data[1] << 8) | (value.data[2] << 16) | ((uint32_t)value.data[3] << 24);
+                    stringstream hex;
+                    hex << "dword:" << setw(8) << setfill('0') << std::hex << dword;
+                    text += hex.str();
+                } else if (value.type == REG_BINARY) {
+                    text += "hex:" + hexBytes(value.data);
+                } else {
+                    stringstream prefix;
+                    prefix << "hex(" << std::hex << value.type << "):";
+                    text += prefix.str() + hexBytes(value.data);
+                }
+                text += "\r\n";
+            }
+        }
+        text += "\r\n";
+        
+        ofstream out(file, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        out.write("\xFF\xFE", 2);
+        u16string units = utf8ToUtf16(text);
+        for (char16_t unit : units) {
+            char pair[2] = {static_cast<char>(unit & 0xFF), static_cast<char>(unit >> 8)};
+            out.write(pair, 2);
+        }
+        return out.good();
+    }
+    
+    // Queue every captured value back into a batch for restore. Tombstones
+    // are deletes, not writes, and are left to removeValues.
+    static void toBatch(const RegistrySnapshot& snapshot, RegistryBatch& batch) {
+        for (const auto& key : snapshot.keys) {
+            for (const auto& value : key.values) {
+                if (!value.absent()) batch.setRaw(key.path, value.name, value.type, value.data);
+            }
+        }
+    }
+    
+#ifdef _WIN32
+    // Delete every value named in snapshot. A value that is already gone
+    // counts as removed; failed counts the rest.
+    static size_t removeValues(HKEY root, const RegistrySnapshot& snapshot, size_t& failed) {
+        size_t removed = 0;
+        for (const auto& key : snapshot.keys) {
+            RegistryKeyGuard keyGuard;
+            if (!keyGuard.openForRead(root, key.path, KEY_SET_VALUE)) {
+                failed += key.values.size();
+                continue;
+            }
+            for (const auto& value : key.values) {
+                u16string wideName = utf8ToUtf16(value.name);
+                LONG status = RegDeleteValueW(keyGuard.get(), reinterpret_cast<LPCWSTR>(wideName.c_str()));
+                if (status == ERROR_SUCCESS || status == ERROR_FILE_NOT_FOUND) {
+                    removed++;
+                } else {
+                    failed++;
+                }
+            }
+        }
+        return removed;
+    }
+#endif
+};
+
+// Diff engine: compares a target batch against the live values so only the
+// values that actually differ are backed up and written
+class RegistryDiff {
+private:
+    static bool equalsIgnoreCase(const string& a, const string& b) {
+        return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y));
+        });
+    }
+    
+    static const RegistrySnapshot::Key* findKey(const RegistrySnapshot& snapshot, const string& path) {
+        for (const auto& key : snapshot.keys) {
+            if (equalsIgnoreCase(key.path, path)) return &key;
+        }
+        return nullptr;
+    }
+    
+    static const RegistrySnapshot::Value* findValue(const RegistrySnapshot::Key* key, const string& name) {
+        if (key == nullptr) return nullptr;
+        for (const auto& value : key->values) {
+            if (equalsIgnoreCase(value.name, name)) return &value;
+        }
+        return nullptr;
+    }
+    
+public:
+    static bool matches(const RegistryBatch::Write& write, const RegistrySnapshot::Value& current) {
+        if (current.type != write.type) return false;
+        if (write.raw) return current.data == write.rawData;
+        // Encoded batches compare bytes first; the decode below only runs
+        // for values stored in an unusual form (e.g. no terminator)
+        if (!write.wire.empty() && current.data == write.wire) return true;
+        if (write.type == REG_SZ) return registryStringToUtf8(current.data) == write.data;
+        if (write.type == REG_DWORD) {
+            if (current.data.size() != 4) return false;
+            uint32_t value = current.data[0] | (current.data[1] << 8) | (current.data[2] << 16) | ((uint32_t)current.data[3] << 24);
+            try {
+                return value == stoul(write.data);
+            } catch (const exception&) {
+                return false;
+            }
+        }
+        return false;
+    }
+    
+    // Writes from target whose value is missing or different in current
+    static RegistryBatch delta(const RegistryBatch& target, const RegistrySnapshot& current) {
+        RegistryBatch changes;
+        for (const auto& key : target.entries()) {
+            const RegistrySnapshot::Key* live = findKey(current, key.first);
+            for (const auto& write : key.second) {
+                const RegistrySnapshot::Value* value = findValue(live, write.valueName);
+                if (value == nullptr || !matches(write, *value)) {
+                    changes.add(key.first, write);
+                }
+            }
+        }
+        return changes;
+    }
+    
+    // Same, as a view of target's writes in the caller's arena
+    static void delta(const RegistryBatch& target, const RegistrySnapshot& current, RegistryBatchView& changes) {
+        for (const auto& key : target.entries()) {
+            const RegistrySnapshot::Key* live = findKey(current, key.first);
+            for (const auto& write : key.second) {
+                const RegistrySnapshot::Value* value = findValue(live, write.valueName);
+                if (value == nullptr || !matches(write, *value)) {
+                    changes.add(key.first, write);
+                }
+            }
+        }
+    }
+    
+    // The subset of current that a delta is about to overwrite (what needs
+    // backing up), with a tombstone for each value it is about to create
+    template <typename Batch>
+    static RegistrySnapshot affected(const RegistrySnapshot& current, const Batch& changes) {
+        RegistrySnapshot subset;
+        subset.capturedAt = current.capturedAt;
+        for (const auto& key : changes.entries()) {
+            const string& keyPath = RegistryBatch::deref(key.first);
+            const RegistrySnapshot::Key* live = findKey(current, keyPath);
+            RegistrySnapshot::Key saved;
+            saved.path = keyPath;
+            for (const auto& entry : key.second) {
+                const string& name = RegistryBatch::deref(entry).valueName;
+                const RegistrySnapshot::Value* value = findValue(live, name);
+                if (value != nullptr) {
+                    saved.values.push_back(*value);
+                } else {
+                    saved.values.push_back({name, RegistrySnapshot::kAbsentType, {}});
+                }
+            }
+            if (!saved.values.empty()) subset.keys.push_back(move(saved));
+        }
+        return subset;
+    }
+    
+    // The tombstones of snapshot whose value exists again in current: what
+    // restoring snapshot has to delete
+    static RegistrySnapshot resurrected(const RegistrySnapshot& snapshot, const RegistrySnapshot& current) {
+        RegistrySnapshot out;
+        for (const auto& key : snapshot.keys) {
+            const RegistrySnapshot::Key* live = findKey(current, key.path);
+            RegistrySnapshot::Key present;
+            present.path = key.path;
+            for (const auto& value : key.values) {
+                if (value.absent() && findValue(live, value.name) != nullptr) present.values.push_back(value);
+            }
+            if (!present.values.empty()) out.keys.push_back(move(present));
+        }
+        return out;
+    }
+};
+
+// Compiled change plan: the writes one locale needs on top of one baseline,
+// already diffed and encoded, so executing it is a handful of registry
+// calls with no locale lookup, JSON or diffing on the target machine.
+//
+// Layout (little-endian):
+//   "RPLN" u16 version u16 reserved
+//   u16 localeLen locale u16 baselineLen baseline
+//   u32 opsLen ops      (an RSNP snapshot holding the exact values to write)
+//   u32 FNV-1a checksum of everything before it
+struct ChangePlan {
+    static constexpr uint16_t kVersion = 1;
+    
+    string locale;
+    string baseline;            // store id or fingerprint of the state it was planned against
+    RegistrySnapshot ops;
+    
+    // Capture the writes of a diffed batch in their final wire form
+    static bool fromBatch(const RegistryBatch& changes, ChangePlan& plan) {
+        plan.ops.keys.clear();
+        for (const auto& key : changes.entries()) {
+            RegistrySnapshot::Key planned;
+            planned.path = key.first;
+            for (const auto& write : key.second) {
+                vector<uint8_t> scratch;
+                const vector<uint8_t>* bytes = RegistryBatch::valueBytes(write, scratch);
+                if (bytes == nullptr) return false;
+                planned.values.push_back({write.valueName, write.type, *bytes});
+            }
+            plan.ops.keys.push_back(move(planned));
+        }
+        return true;
+    }
+    
+    size_t size() const { return ops.valueCount(); }
+    
+    // Raw writes plus UTF-16 names: the batch applies without any conversion
+    RegistryBatch batch() const {
+        RegistryBatch out;
+        NativeBackup::toBatch(ops, out);
+        out.encode();
+        return out;
+    }
+    
+    vector<uint8_t> serialize() const {
+        vector<uint8_t> body = NativeBackup::serialize(ops);
+        vector<uint8_t> out;
+        out.reserve(24 + locale.size() + baseline.size() + body.size());
+        auto put = [&out](uint64_t v, int bytes) {
+            for (int i = 0; i < bytes; i++) out.push_back((v >> (8 * i)) & 0xFF);
+        };
+        out.insert(out.end(), {'R', 'P', 'L', 'N'});
+        put(kVersion, 2);
+        put(0, 2);
+        put(locale.size(), 2);
+        out.insert(out.end(), locale.begin(), locale.end());
+        put(baseline.size(), 2);
+        out.insert(out.end(), baseline.begin(), baseline.end());
+        put(body.size(), 4);
+        out.insert(out.end(), body.begin(), body.end());
+        put(fnv1a32(out.data(), out.size()), 4);
+        return out;
+    }
+    
+    static bool deserialize(const uint8_t* data, size_t size, ChangePlan& plan) {
+        if (size < 20 || memcmp(data, "RPLN", 4) != 0) return false;
+        size_t end = size - 4;
+        uint32_t stored = data[end] | (data[end + 1] << 8) | (data[end + 2] << 16) | ((uint32_t)data[end + 3] << 24);
+        if (stored != fnv1a32(data, end)) return false;
+        
+        size_t pos = 4;
+        auto get = [&](size_t bytes, uint64_t& v) {
+            if (end - pos < bytes) return false;
+            v = 0;
+            for (size_t i = 0; i < bytes; i++) v |= (uint64_t)data[pos + i] << (8 * i);
+            pos += bytes;
+            return true;
+        };
+        auto text = [&](string& out) {
+            uint64_t length = 0;
+            if (!get(2, length) || end - pos < length) return false;
+            out.assign(reinterpret_cast<const char*>(data + pos), static_cast<size_t>(length));
+            pos += static_cast<size_t>(length);
+            return true;
+        };
+        uint64_t version = 0, reserved = 0, opsLength = 0;
+        if (!get(2, version) || version != kVersion || !get(2, reserved)) return false;
+        if (!text(plan.locale) || !text(plan.baseline) || !get(4, opsLength) || end - pos != opsLength) return false;
+        return NativeBackup::deserialize(data + pos, static_cast<size_t>(opsLength), plan.ops);
+    }
+    
+    // Written to a temp file and renamed, so a half-written plan is never shipped
+    bool save(const string& file) const {
+        vector<uint8_t> bytes = serialize();
+        string temp = file + ".tmp";
+        {
+            ofstream out(temp, ios::binary | ios::trunc);
+            if (!out.is_open()) return false;
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            if (!out.good()) return false;
+        }
+        error_code ec;
+        fs::rename(temp, file, ec);
+        return !ec;
+    }
+    
+    static bool load(const string& file, ChangePlan& plan) {
+        MappedFile mapped;
+        if (!mapped.open(file)) return false;
+        return deserialize(mapped.data(), mapped.size(), plan);
+    }
+};
+
+#ifdef _WIN32
+// The real registry: RegCreateKeyEx/RegSetValueEx, with KTM transactions
+// when requested and available
+class Win32RegistryBackend : public IRegistryBackend {
+private:
+    static LONG writeValue(HKEY hKey, const RegistryWrite& write, Logger& logger) {
+        vector<uint8_t> scratch;
+        const vector<uint8_t>* bytes = RegistryBatch::valueBytes(write, scratch);
+        if (bytes == nullptr) {
+            logger.error(RegistryBatch::encodeError(write));
+            return ERROR_INVALID_PARAMETER;
+        }
+        u16string convertedName;
+        const u16string* name = &write.wideName;
+        if (name->empty() && !write.valueName.empty()) {
+            convertedName = utf8ToUtf16(write.valueName);
+            name = &convertedName;
+        }
+        return RegSetValueExW(hKey, reinterpret_cast<LPCWSTR>(name->c_str()), 0, write.type,
+                              bytes->data(), static_cast<DWORD>(bytes->size()));
+    }
+    
+    class Win32Session : public Session {
+    private:
+        HKEY root;
+        KtmTransaction transaction;
+        // Keys are opened once per session; batches hold a handful of paths
+        vector<pair<string, unique_ptr<RegistryKeyGuard>>> handles;
+        
+        HKEY handleFor(const string& keyPath) const {
+            for (const auto& entry : handles) {
+                if (entry.first == keyPath) return entry.second->get();
+            }
+            return NULL;
+        }
+        
+    public:
+        Win32Session(HKEY root, bool transactional) : root(root) {
+            if (transactional) transaction.begin();
+        }
+        
+        bool transacted() const override { return transaction.isActive(); }
+        
+        LONG openKey(const string& keyPath) override {
+            if (handleFor(keyPath) != NULL) return ERROR_SUCCESS;
+            unique_ptr<RegistryKeyGuard> keyGuard(new RegistryKeyGuard());
+            LONG status = transaction.isActive() ? keyGuard->openTransacted(root, keyPath, transaction.get())
+                                                : keyGuard->open(root, keyPath);
+            if (status != ERROR_SUCCESS) return status;
+            handles.emplace_back(keyPath, move(keyGuard));
+            return ERROR_SUCCESS;
+        }
+        
+        LONG setValue(const string& keyPath, const RegistryWrite& write, Logger& logger) override {
+            LONG status = openKey(keyPath);
+            if (status != ERROR_SUCCESS) return status;
+            return writeValue(handleFor(keyPath), write, logger);
+        }
+        
+        bool commit() override {
+            // Transacted handles must be closed before the transaction finishes
+            handles.clear();
+            return transaction.commit();
+        }
+        
+        void rollback() override {
+            handles.clear();
+            if (transaction.isActive()) transaction.rollback();
+        }
+    };
+    
+public:
+    const char* name() const override { return "win32"; }
+    
+    unique_ptr<Session> open(HKEY root, bool transactional) override {
+        return unique_ptr<Session>(new Win32Session(root, transactional));
+    }
+    
+    bool readValues(HKEY root, const string& keyPath, RegistrySnapshot& snapshot) override {
+        return NativeBackup::captureValues(root, keyPath, snapshot);
+    }
+};
+#endif
+
+// In-memory registry for benchmarks and demo mode. Keys are sharded by hash
+// so sessions on different hives rarely contend, and every operation can be
+// given a simulated latency to model the cost of a real registry call.
+class MockRegistryBackend : public IRegistryBackend {
+private:
+    static constexpr size_t kShards = 16;
+    
+    struct Shard {
+        mutex lock;
+        unordered_map<string, vector<RegistrySnapshot::Value>> keys;
+    };
+    
+    array<Shard, kShards> shards;
+    chrono::microseconds latency;
+    atomic<uint64_t> operations{0};
+    
+    // Registry paths are case-insensitive; the root handle keeps hives apart
+    static string keyId(HKEY root, const string& keyPath) {
+        string id = to_string(reinterpret_cast<uintptr_t>(root)) + "\\";
+        for (char c : keyPath) id += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return id;
+    }
+    
+    Shard& shardFor(const string& id) {
+        return shards[fnv1a32(reinterpret_cast<const uint8_t*>(id.data()), id.size()) % kShards];
+    }
+    
+    // Spin rather than sleep: sleep granularity is far coarser than a registry call
+    void simulateCall() {
+        operations++;
+        if (latency.count() == 0) return;
+        auto until = chrono::steady_clock::now() + latency;
+        while (chrono::steady_clock::now() < until) {}
+    }
+    
+    void store(const string& id, RegistrySnapshot::Value value) {
+        Shard& shard = shardFor(id);
+        lock_guard<mutex> guard(shard.lock);
+        vector<RegistrySnapshot::Value>& values = shard.keys[id];
+        for (auto& existing : values) {
+            if (existing.name.size() == value.name.size() &&
+                equal(existing.name.begin(), existing.name.end(), value.name.begin(), [](char x, char y) {
+                    return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y));
+                })) {
+                existing = move(value);
+                return;
+            }
+        }
+        values.push_back(move(value));
+    }
+    
+    // Transactional sessions buffer their writes and publish them on commit
+    class MockSession : public Session {
+    private:
+        MockRegistryBackend& backend;
+        HKEY root;
+        bool transactional;
+        vector<pair<string, RegistrySnapshot::Value>> pending;
+        
+    public:
+        MockSession(MockRegistryBackend& backend, HKEY root, bool transactional)
+            : backend(backend), root(root), transactional(transactional) {}
+        
+        bool transacted() const override { return transactional; }
+        
+        LONG openKey(const string& keyPath) override {
+            (void)keyPath;
+            backend.simulateCall();
+            return ERROR_SUCCESS;
+        }
+        
+        LONG setValue(const string& keyPath, const RegistryWrite& write, Logger& logger) override {
+            backend.simulateCall();
+            vector<uint8_t> scratch;
+            const vector<uint8_t>* bytes = RegistryBatch::valueBytes(write, scratch);
+            if (bytes == nullptr) {
+                logger.error(RegistryBatch::encodeError(write));
+                return ERROR_INVALID_PARAMETER;
+            }
+            RegistrySnapshot::Value value{write.valueName, write.type, *bytes};
+            string id = keyId(root, keyPath);
+            if (transactional) {
+                pending.emplace_back(move(id), move(value));
+            } else {
+                backend.store(id, move(value));
+            }
+            return ERROR_SUCCESS;
+        }
+        
+        bool commit() override {
+            for (auto& entry : pending) backend.store(entry.first, move(entry.second));
+            pending.clear();
+            return true;
+        }
+        
+        void rollback() override { pending.clear(); }
+    };
+    
+public:
+    explicit MockRegistryBackend(chrono::microseconds latency = chrono::microseconds(0)) : latency(latency) {}
+    
+    const char* name() const override { return "mock"; }
+    
+    unique_ptr<Session> open(HKEY root, bool transactional) override {
+        return unique_ptr<Session>(new MockSession(*this, root, transactional));
+    }
+    
+    bool readValues(HKEY root, const string& keyPath, RegistrySnapshot& snapshot) override {
+        simulateCall();
+        snapshot.keys.clear();
+        snapshot.capturedAt = static_cast<int64_t>(time(nullptr));
+        string id = keyId(root, keyPath);
+        Shard& shard = shardFor(id);
+        lock_guard<mutex> guard(shard.lock);
+        auto it = shard.keys.find(id);
+        if (it == shard.keys.end()) return false;
+        snapshot.keys.push_back({keyPath, it->second});
+        return true;
+    }
+    
+    uint64_t operationCount() const { return operations.load(); }
+};
+
+IRegistryBackend& defaultRegistryBackend() {
+#ifdef _WIN32
+    static Win32RegistryBackend backend;
+#else
+    static MockRegistryBackend backend;
+#endif
+    return backend;
+}
+
+// LZ4 block format (without the frame layer): a greedy single-pass
+// compressor and a bounds-checked decoder. Snapshot payloads are small and
+// highly repetitive UTF-16, which this handles well without a dependency.
+namespace lz4 {
+    constexpr size_t kMinMatch = 4;
+    constexpr size_t kLastLiterals = 5;    // the block must end in literals
+    constexpr size_t kMatchLimit = 12;     // no match may start in the last 12 bytes
+    constexpr int kHashBits = 12;
+    
+    inline uint32_t read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+    
+    inline uint32_t hash(uint32_t sequence) {
+        return (sequence * 2654435761u) >> (32 - kHashBits);
+    }
+    
+    inline void putLength(vector<uint8_t>& out, size_t length) {
+        for (; length >= 255; length -= 255) out.push_back(255);
+        out.push_back(static_cast<uint8_t>(length));
+    }
+    
+    inline vector<uint8_t> compress(const uint8_t* src, size_t size) {
+        vector<uint8_t> out;
+        out.reserve(size + size / 255 + 16);
+        size_t anchor = 0;
+        if (size > kMatchLimit) {
+            vector<int64_t> table(size_t(1) << kHashBits, -1);
+            size_t limit = size - kMatchLimit;
+            size_t i = 0;
+            while (i < limit) {
+                uint32_t sequence = read32(src + i);
+                uint32_t slot = hash(sequence);
+                int64_t candidate = table[slot];
+                table[slot] = static_cast<int64_t>(i);
+                if (candidate < 0 || i - candidate > 65535 || read32(src + candidate) != sequence) {
+                    i++;
+                    continue;
+                }
+                size_t matchEnd = i + kMinMatch;
+                size_t reference = static_cast<size_t>(candidate) + kMinMatch;
+                while (matchEnd < size - kLastLiterals && src[matchEnd] == src[reference]) {
+                    matchEnd++;
+                    reference++;
+                }
+                size_t literals = i - anchor;
+                size_t matchLength = matchEnd - i - kMinMatch;
+                out.push_back(static_cast<uint8_t>((min<size_t>(literals, 15) << 4) | min<size_t>(matchLength, 15)));
+                if (literals >= 15) putLength(out, literals - 15);
+                out.insert(out.end(), src + anchor, src + i);
+                size_t offset = i - static_cast<size_t>(candidate);
+                out.push_back(static_cast<uint8_t>(offset & 0xFF));
+                out.push_back(static_cast<uint8_t>(offset >> 8));
+                if (matchLength >= 15) putLength(out, matchLength - 15);
+                i = matchEnd;
+                anchor = i;
+            }
+        }
+        size_t literals = size - anchor;
+        out.push_back(static_cast<uint8_t>(min<size_t>(literals, 15) << 4));
+        if (literals >= 15) putLength(out, literals - 15);
+        out.insert(out.end(), src + anchor, src + size);
+        return out;
+    }
+    
+    inline bool decompress(const uint8_t* src, size_t size, size_t expected, vector<uint8_t>& out) {
+        out.clear();
+        out.reserve(expected);
+        size_t i = 0;
+        auto readLength = [&](size_t& length) {
+            uint8_t next;
+            do {
+                if (i >= size) return false;
+                next = src[i++];
+                length += next;
+            } while (next == 255);
+            return true;
+        };
+        while (i < size) {
+            uint8_t token = src[i++];
+            size_t literals = token >> 4;
+            if (literals == 15 && !readLength(literals)) return false;
+            if (literals > size - i || literals > expected - out.size()) return false;
+            out.insert(out.end(), src + i, src + i + literals);
+            i += literals;
+            if (i == size) break;              // final sequence carries no match
+            if (size - i < 2) return false;
+            size_t offset = src[i] | (src[i + 1] << 8);
+            i += 2;
+            if (offset == 0 || offset > out.size()) return false;
+            size_t matchLength = token & 15;
+            if (matchLength == 15 && !readLength(matchLength)) return false;
+            matchLength += kMinMatch;
+            if (matchLength > expected - out.size()) return false;
+            size_t from = out.size() - offset;
+            for (size_t k = 0; k < matchLength; k++) {
+                uint8_t byte = out[from + k];
+                out.push_back(byte);
+            }
+        }
+        return out.size() == expected;
+    }
+}
+
+// Append-only archive of compressed snapshot objects. Entries are encoded in
+// memory and streamed straight onto the end of the file (no temporary
+// files), and each carries a checksum of its uncompressed bytes, so any one
+// entry can be read or verified without touching the others.
+//
+//   entry := "RPKE" u16 version, u16 codec, u64 object, u32 raw size,
+//            u32 stored size, u32 FNV-1a of raw bytes, u32 reserved, payload
+class BackupArchive {
+public:
+    enum Codec : uint16_t { Stored = 0, Lz4Block = 1 };
+    
+    struct VerifyResult {
+        size_t checked = 0;
+        size_t corrupt = 0;
+        string damage;      // why entries past some offset cannot be read, if they cannot
+    };
+    
+private:
+    static constexpr uint16_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 32;
+    
+    string file;
+    unordered_map<uint64_t, uint64_t> offsets;     // object hash -> entry offset
+    uint64_t endOffset = 0;
+    MappedFile view;
+    bool viewStale = true;
+    string damaged;     // set when open() stopped before the end: the archive is then read-only
+    
+    static uint16_t get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+    static uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+    static uint64_t get64(const uint8_t* p) { return get32(p) | ((uint64_t)get32(p + 4) << 32); }
+    
+    static void put16(uint8_t* p, uint16_t v) { p[0] = v & 0xFF; p[1] = v >> 8; }
+    static void put32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; i++) p[i] = (v >> (8 * i)) & 0xFF; }
+    static void put64(uint8_t* p, uint64_t v) { put32(p, static_cast<uint32_t>(v)); put32(p + 4, static_cast<uint32_t>(v >> 32)); }
+    
+    bool mapped() {
+        if (viewStale) {
+            view.close();
+            if (endOffset > 0 && !view.open(file)) return false;
+            viewStale = false;
+        }
+        return endOffset == 0 || view.isOpen();
+    }
+    
+    bool decode(uint64_t offset, vector<uint8_t>& raw) {
+        if (!mapped() || offset + kHeaderSize > view.size()) return false;
+        const uint8_t* header = view.data() + offset;
+        uint16_t codec = get16(header + 6);
+        uint32_t rawSize = get32(header + 16);
+        uint32_t storedSize = get32(header + 20);
+        uint32_t checksum = get32(header + 24);
+        if (memcmp(header, "RPKE", 4) != 0 || offset + kHeaderSize + storedSize > view.size()) return false;
+        const uint8_t* payload = header + kHeaderSize;
+        if (codec == Stored) {
+            if (storedSize != rawSize) return false;
+            raw.assign(payload, payload + storedSize);
+        } else if (codec != Lz4Block || !lz4::decompress(payload, storedSize, rawSize, raw)) {
+            return false;
+        }
+        return fnv1a32(raw.data(), raw.size()) == checksum;
+    }
+    
+public:
+    // Index the entry headers. Only a torn append is cut off: a partial
+    // header, or a valid last header whose payload runs past the end. An
+    // unknown version or bad magic with data after it is left on disk and
+    // makes the archive read-only; the entries before it stay readable.
+    bool open(const string& path) {
+        file = path;
+        offsets.clear();
+        endOffset = 0;
+        damaged.clear();
+        view.close();
+        viewStale = true;
+        error_code ec;
+        if (!fs::exists(file, ec)) return true;
+        uint64_t fileSize = fs::file_size(file, ec);
+        if (ec) return false;
+        if (fileSize == 0) return true;
+        if (!view.open(file)) return false;
+        uint64_t offset = 0;
+        while (offset + kHeaderSize <= view.size()) {
+            const uint8_t* header = view.data() + offset;
+            uint64_t next = offset + kHeaderSize + get32(header + 20);
+            if (memcmp(header, "RPKE", 4) != 0) {
+                damaged = "unrecognized entry at offset " + to_string(offset);
+                break;
+            }
+            if (get16(header + 4) != kVersion) {
+                damaged = "entry of unknown format version " + to_string(get16(header + 4)) + " at offset " + to_string(offset);
+                break;
+            }
+            if (next > view.size()) break;      // torn payload
+            offsets[get64(header + 8)] = offset;
+            offset = next;
+        }
+        view.close();
+        endOffset = offset;
+        if (!damaged.empty()) return true;
+        if (offset != fileSize) {
+            fs::resize_file(file, offset, ec);
+            if (ec) return false;
+        }
+        return true;
+    }
+    
+    // Empty while appends are allowed
+    const string& damage() const { return damaged; }
+    
+    bool contains(uint64_t object) const { return offsets.count(object) != 0; }
+    size_t size() const { return offsets.size(); }
+    
+    bool append(uint64_t object, const vector<uint8_t>& raw) {
+        if (!damaged.empty()) return false;
+        vector<uint8_t> packed = lz4::compress(raw.data(), raw.size());
+        bool compressed = packed.size() < raw.size();
+        const vector<uint8_t>& payload = compressed ? packed : raw;
+        
+        uint8_t header[kHeaderSize] = {'R', 'P', 'K', 'E'};
+        put16(header + 4, kVersion);
+        put16(header + 6, compressed ? Lz4Block : Stored);
+        put64(header + 8, object);
+        put32(header + 16, static_cast<uint32_t>(raw.size()));
+        put32(header + 20, static_cast<uint32_t>(payload.size()));
+        put32(header + 24, fnv1a32(raw.data(), raw.size()));
+        
+        view.close();   // the mapping would block appends on Windows
+        viewStale = true;
+        ofstream out(file, ios::binary | ios::app);
+        if (!out.is_open()) return false;
+        out.write(reinterpret_cast<const char*>(header), kHeaderSize);
+        out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        out.close();
+        if (out.fail() || !syncFile(file)) return false;
+        offsets[object] = endOffset;
+        endOffset += kHeaderSize + payload.size();
+        return true;
+    }
+    
+    // Decompress a single entry and check it against its checksum
+    bool read(uint64_t object, vector<uint8_t>& raw) {
+        auto it = offsets.find(object);
+        return it != offsets.end() && decode(it->second, raw);
+    }
+    
+    VerifyResult verify() {
+        VerifyResult result;
+        result.damage = damaged;
+        vector<uint8_t> raw;
+        for (const auto& entry : offsets) {
+            result.checked++;
+            if (!decode(entry.second, raw)) result.corrupt++;
+        }
+        return result;
+    }
+};
+
+// Content-addressed, incremental backup store. Each snapshot id is the
+// hash of its scope and contents, so an unchanged state is never stored
+// twice; objects hold only the delta against the previous snapshot of the
+// same scope, with a full snapshot every kMaxChain links. The directory is
+// created on the first commit, so runs that write nothing leave no trace.
+//
+//   <root>/snapshots.idx    one tab-separated line per snapshot, append-only
+//   <root>/objects.pack     BackupArchive of NativeBackup-encoded full or
+//                           delta snapshots, keyed by object hash
+class BackupStore {
+public:
+    struct Entry {
+        string id;
+        string parent;          // empty for full snapshots
+        string object;
+        int depth = 0;          // delta links back to the last full snapshot
+        int64_t capturedAt = 0;
+        size_t valueCount = 0;
+        string scope;           // "<hive or profile>\<key path>"
+    };
+    
+private:
+    static constexpr int kMaxChain = 16;
+    static constexpr DWORD kDeletedType = 0xFFFFFFFF;   // delta tombstone
+    
+    string root;
+    mutable mutex lock;
+    bool opened = false;
+    vector<Entry> entries;                      // index order
+    unordered_map<string, size_t> byId;
+    unordered_map<string, size_t> latestByScope;
+    size_t latestIndex = SIZE_MAX;
+    BackupArchive archive;
+    
+    static string hex64(uint64_t value) {
+        char text[17];
+        snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+        return text;
+    }
+    
+    static string contentId(const RegistrySnapshot& snapshot, const string& scope) {
+        RegistrySnapshot normalized = snapshot;
+        normalized.capturedAt = 0;
+        vector<uint8_t> bytes = NativeBackup::serialize(normalized);
+        return hex64(fnv1a64(bytes.data(), bytes.size(), fnv1a64(reinterpret_cast<const uint8_t*>(scope.data()), scope.size())));
+    }
+    
+    static const RegistrySnapshot::Value* findValue(const RegistrySnapshot::Key& key, const string& name) {
+        for (const auto& value : key.values) {
+            if (value.name == name) return &value;
+        }
+        return nullptr;
+    }
+    
+    static RegistrySnapshot::Key* findKey(RegistrySnapshot& snapshot, const string& path) {
+        for (auto& key : snapshot.keys) {
+            if (key.path == path) return &key;
+        }
+        return nullptr;
+    }
+    
+    // Values added or changed in current, plus tombstones for removed ones
+    static RegistrySnapshot delta(const RegistrySnapshot& previous, const RegistrySnapshot& current) {
+        RegistrySnapshot out;
+        out.capturedAt = current.capturedAt;
+        RegistrySnapshot prev = previous;
+        for (const auto& key : current.keys) {
+            RegistrySnapshot::Key changed;
+            changed.path = key.path;
+            const RegistrySnapshot::Key* old = findKey(prev, key.path);
+            for (const auto& value : key.values) {
+                const RegistrySnapshot::Value* before = old ? findValue(*old, value.name) : nullptr;
+                if (before == nullptr || before->type != value.type || before->data != value.data) {
+                    changed.values.push_back(value);
+                }
+            }
+            if (old != nullptr) {
+                for (const auto& value : old->values) {
+                    if (findValue(key, value.name) == nullptr) changed.values.push_back({value.name, kDeletedType, {}});
+                }
+            }
+            if (!changed.values.empty()) out.keys.push_back(move(changed));
+        }
+        for (const auto& key : prev.keys) {
+            bool kept = any_of(current.keys.begin(), current.keys.end(), [&](const RegistrySnapshot::Key& k) { return k.path == key.path; });
+            if (kept) continue;
+            RegistrySnapshot::Key removed;
+            removed.path = key.path;
+            for (const auto& value : key.values) removed.values.push_back({value.name, kDeletedType, {}});
+            out.keys.push_back(move(removed));
+        }
+        return out;
+    }
+    
+    static void overlay(RegistrySnapshot& base, const RegistrySnapshot& changes) {
+        base.capturedAt = changes.capturedAt;
+        for (const auto& key : changes.keys) {
+            RegistrySnapshot::Key* target = findKey(base, key.path);
+            if (target == nullptr) {
+                base.keys.push_back({key.path, {}});
+                target = &base.keys.back();
+            }
+            for (const auto& value : key.values) {
+                auto existing = find_if(target->values.begin(), target->values.end(),
+                                        [&](const RegistrySnapshot::Value& v) { return v.name == value.name; });
+                if (value.type == kDeletedType) {
+                    if (existing != target->values.end()) target->values.erase(existing);
+                } else if (existing != target->values.end()) {
+                    *existing = value;
+                } else {
+                    target->values.push_back(value);
+                }
+            }
+        }
+        base.keys.erase(remove_if(base.keys.begin(), base.keys.end(),
+                                  [](const RegistrySnapshot::Key& k) { return k.values.empty(); }), base.keys.end());
+    }
+    
+    string indexPath() const { return root + "/snapshots.idx"; }
+    string archivePath() const { return root + "/objects.pack"; }
+    
+    bool readObject(const string& object, RegistrySnapshot& snapshot) {
+        vector<uint8_t> bytes;
+        if (archive.read(strtoull(object.c_str(), nullptr, 16), bytes)) {
+            return NativeBackup::deserialize(bytes.data(), bytes.size(), snapshot);
+        }
+        // Loose object files from stores written before the archive existed
+        return NativeBackup::load(root + "/objects/" + object, snapshot);
+    }
+    
+    void index(const Entry& entry) {
+        auto found = byId.find(entry.id);
+        size_t position;
+        if (found == byId.end()) {
+            position = entries.size();
+            entries.push_back(entry);
+            byId[entry.id] = position;
+        } else {
+            position = found->second;   // same content seen again; keep the stored chain
+        }
+        latestByScope[entry.scope] = position;
+        latestIndex = position;
+    }
+    
+    static string indexLine(const Entry& entry) {
+        return entry.id + '\t' + (entry.parent.empty() ? "-" : entry.parent) + '\t' + entry.object + '\t' +
+               to_string(entry.depth) + '\t' + to_string(entry.capturedAt) + '\t' + to_string(entry.valueCount) + '\t' +
+               entry.scope + '\n';
+    }
+    
+    // Move an indexed snapshot to the end, so it is the latest of its scope
+    // again, and rewrite snapshots.idx to match: one line per snapshot id,
+    // however often a state recurs. Callers hold lock.
+    bool promoteLocked(size_t position) {
+        string temp = indexPath() + ".tmp";
+        vector<Entry> reordered;
+        reordered.reserve(entries.size());
+        {
+            ofstream out(temp, ios::trunc);
+            if (!out.is_open()) return false;
+            for (size_t i = 0; i < entries.size(); i++) {
+                if (i != position) reordered.push_back(entries[i]);
+            }
+            reordered.push_back(entries[position]);
+            for (const auto& entry : reordered) out << indexLine(entry);
+            out.close();
+            if (out.fail() || !syncFile(temp)) return false;
+        }
+        error_code ec;
+        fs::rename(temp, indexPath(), ec);
+        if (ec) return false;
+        entries.clear();
+        byId.clear();
+        latestByScope.clear();
+        for (const auto& entry : reordered) index(entry);
+        return true;
+    }
+    
+    // Load the index once; callers hold lock
+    bool openLocked(bool create) {
+        if (opened) return true;
+        error_code ec;
+        if (!fs::exists(indexPath(), ec)) {
+            if (!create) return false;
+            fs::create_directories(root, ec);
+            if (ec || !archive.open(archivePath())) return false;
+            opened = true;
+            return true;
+        }
+        ifstream in(indexPath());
+        string line;
+        while (getline(in, line)) {
+            vector<string> fields;
+            size_t start = 0;
+            for (size_t tab; (tab = line.find('\t', start)) != string::npos; start = tab + 1) {
+                fields.push_back(line.substr(start, tab - start));
+            }
+            fields.push_back(line.substr(start));
+            if (fields.size() != 7) continue;
+            Entry entry;
+            entry.id = fields[0];
+            entry.parent = fields[1] == "-" ? string() : fields[1];
+            entry.object = fields[2];
+            entry.depth = atoi(fields[3].c_str());
+            entry.capturedAt = atoll(fields[4].c_str());
+            entry.valueCount = static_cast<size_t>(atoll(fields[5].c_str()));
+            entry.scope = fields[6];
+            index(entry);
+        }
+        if (!archive.open(archivePath())) return false;
+        opened = true;
+        return true;
+    }
+    
+    bool loadLocked(const string& id, RegistrySnapshot& snapshot) {
+        vector<const Entry*> chain;
+        for (auto it = byId.find(id); it != byId.end(); it = byId.find(entries[it->second].parent)) {
+            chain.push_back(&entries[it->second]);
+            if (entries[it->second].parent.empty() || chain.size() > kMaxChain) break;
+        }
+        if (chain.empty() || !chain.back()->parent.empty()) return false;
+        
+        snapshot = RegistrySnapshot();
+        for (auto link = chain.rbegin(); link != chain.rend(); ++link) {
+            RegistrySnapshot part;
+            if (!readObject((*link)->object, part)) return false;
+            overlay(snapshot, part);
+        }
+        return true;
+    }
+    
+public:
+    explicit BackupStore(const string& rootPath = "backups") : root(rootPath) {}
+    
+    const string& path() const { return root; }
+    
+    void setPath(const string& rootPath) {
+        lock_guard<mutex> guard(lock);
+        if (!opened) root = rootPath;
+    }
+    
+    bool isOpen() const {
+        lock_guard<mutex> guard(lock);
+        return opened;
+    }
+    
+    // Why commits are refused, empty while the archive is writable
+    string damage() const {
+        lock_guard<mutex> guard(lock);
+        return archive.damage();
+    }
+    
+    // Record a snapshot; returns its id, or "" on failure. Thread-safe.
+    string commit(const RegistrySnapshot& snapshot, const string& scope) {
+        lock_guard<mutex> guard(lock);
+        if (!openLocked(true)) return string();
+        
+        Entry entry;
+        entry.id = contentId(snapshot, scope);
+        entry.scope = scope;
+        entry.capturedAt = snapshot.capturedAt;
+        entry.valueCount = snapshot.valueCount();
+        
+        auto latest = latestByScope.find(scope);
+        if (latest != latestByScope.end() && entries[latest->second].id == entry.id) {
+            return entry.id;    // identical to the newest snapshot of this scope
+        }
+        auto known = byId.find(entry.id);
+        if (known != byId.end()) {
+            // Back to an earlier state: already stored, only the order changes
+            return promoteLocked(known->second) ? entry.id : string();
+        }
+        RegistrySnapshot stored = snapshot;
+        RegistrySnapshot previous;
+        if (latest != latestByScope.end() && entries[latest->second].depth + 1 < kMaxChain &&
+            loadLocked(entries[latest->second].id, previous)) {
+            stored = delta(previous, snapshot);
+            entry.parent = entries[latest->second].id;
+            entry.depth = entries[latest->second].depth + 1;
+        }
+        vector<uint8_t> bytes = NativeBackup::serialize(stored);
+        uint64_t object = fnv1a64(bytes.data(), bytes.size());
+        entry.object = hex64(object);
+        if (!archive.contains(object) && !archive.append(object, bytes)) return string();
+        
+        ofstream out(indexPath(), ios::app);
+        if (!out.is_open()) return string();
+        out << indexLine(entry);
+        out.close();
+        // The caller writes the registry as soon as this returns
+        if (out.fail() || !syncFile(indexPath())) return string();
+        index(entry);
+        return entry.id;
+    }
+    
+    // Rebuild a snapshot from its delta chain
+    bool load(const string& id, RegistrySnapshot& snapshot) {
+        lock_guard<mutex> guard(lock);
+        return openLocked(false) && loadLocked(id, snapshot);
+    }
+    
+    // O(1): newest snapshot overall, or of one scope when given
+    bool latest(Entry& out, const string& scope = "") {
+        lock_guard<mutex> guard(lock);
+        if (!openLocked(false)) return false;
+        if (scope.empty()) {
+            if (latestIndex == SIZE_MAX) return false;
+            out = entries[latestIndex];
+            return true;
+        }
+        auto it = latestByScope.find(scope);
+        if (it == latestByScope.end()) return false;
+        out = entries[it->second];
+        return true;
+    }
+    
+    // Check every archived object against its checksum
+    BackupArchive::VerifyResult verify() {
+        lock_guard<mutex> guard(lock);
+        if (!openLocked(false)) return BackupArchive::VerifyResult();
+        return archive.verify();
+    }
+    
+    bool find(const string& id, Entry& out) {
+        lock_guard<mutex> guard(lock);
+        if (!openLocked(false)) return false;
+        auto it = byId.find(id);
+        if (it == byId.end()) return false;
+        out = entries[it->second];
+        return true;
+    }
+};
+
+// Tells running applications that the international settings changed so
+// Explorer and open programs pick them up without a logoff. With
+// HWND_BROADCAST the timeout applies per window, so the send runs on its
+// own thread and the caller stops waiting after one overall deadline.
+class SettingChangeBroadcast {
+public:
+    enum Result { Delivered, TimedOut, Failed, Disabled };
+    
+    static Result send(chrono::milliseconds deadline) {
+        if (deadline.count() <= 0) return Disabled;
+#ifdef _WIN32
+        auto done = make_shared<promise<bool>>();
+        future<bool> delivered = done->get_future();
+        UINT perWindow = static_cast<UINT>(deadline.count());
+        thread([done, perWindow] {
+            DWORD_PTR reply = 0;
+            LRESULT ok = SendMessageTimeoutW(HWND_BROADCAST, WM_SETTINGCHANGE, 0, reinterpret_cast<LPARAM>(L"intl"),
+                                             SMTO_ABORTIFHUNG, perWindow, &reply);
+            done->set_value(ok != 0);
+        }).detach();
+        if (delivered.wait_for(deadline) != future_status::ready) return TimedOut;
+        return delivered.get() ? Delivered : Failed;
+#else
+        return Delivered;
+#endif
+    }
+};
+
+// Persistent index of user profiles for multi-profile runs. Repeat runs on
+// a terminal server reuse hive paths instead of re-reading ProfileList and
+// skip profiles nothing has touched since they were last found compliant,
+// without mounting their hives. Staleness is judged per entry from
+// last-write times: a SID key's changes when its path does, and each
+// profile's stamp covers the keys (or, for an offline hive, the NTUSER.DAT
+// file) an apply touches.
+//
+// Layout (little-endian):
+//   "RPIX" u16 version u16 reserved u32 count
+//   count x { u16 sidLen sid  u16 pathLen hivePath  u64 keyWrite  u64 stamp  u64 applied }
+//   u32 fnv1a32 of everything before it
+class ProfileIndex {
+public:
+    struct Entry {
+        string hivePath;
+        uint64_t keyWrite = 0;      // ProfileList\<sid> last-write time
+        uint64_t stamp = 0;         // settings stamp after the last compliant apply, 0 = none
+        uint64_t applied = 0;       // fingerprint of what that apply wrote
+    };
+    
+private:
+    static constexpr uint16_t kVersion = 1;
+    
+    string file;
+    mutable mutex lock;             // multi-profile workers update entries concurrently
+    map<string, Entry> entries;
+    bool dirty = false;
+    
+    vector<uint8_t> serialize() const {
+        vector<uint8_t> out;
+        auto put = [&out](uint64_t v, int bytes) {
+            for (int i = 0; i < bytes; i++) out.push_back((v >> (8 * i)) & 0xFF);
+        };
+        out.insert(out.end(), {'R', 'P', 'I', 'X'});
+        put(kVersion, 2);
+        put(0, 2);
+        put(entries.size(), 4);
+        for (const auto& entry : entries) {
+            put(entry.first.size(), 2);
+            out.insert(out.end(), entry.first.begin(), entry.first.end());
+            put(entry.second.hivePath.size(), 2);
+            out.insert(out.end(), entry.second.hivePath.begin(), entry.second.hivePath.end());
+            put(entry.second.keyWrite, 8);
+            put(entry.second.stamp, 8);
+            put(entry.second.applied, 8);
+        }
+        put(fnv1a32(out.data(), out.size()), 4);
+        return out;
+    }
+    
+    bool deserialize(const uint8_t* data, size_t size) {
+        if (size < 16 || memcmp(data, "RPIX", 4) != 0) return false;
+        size_t end = size - 4;
+        uint32_t stored = data[end] | (data[end + 1] << 8) | (data[end + 2] << 16) | ((uint32_t)data[end + 3] << 24);
+        if (stored != fnv1a32(data, end)) return false;
+        
+        size_t pos = 4;
+        auto get = [&](size_t bytes, uint64_t& v) {
+            if (end - pos < bytes) return false;
+            v = 0;
+            for (size_t i = 0; i < bytes; i++) v |= (uint64_t)data[pos + i] << (8 * i);
+            pos += bytes;
+            return true;
+        };
+        auto text = [&](string& out) {
+            uint64_t length = 0;
+            if (!get(2, length) || end - pos < length) return false;
+            out.assign(reinterpret_cast<const char*>(data + pos), static_cast<size_t>(length));
+            pos += static_cast<size_t>(length);
+            return true;
+        };
+        uint64_t version = 0, reserved = 0, count = 0;
+        if (!get(2, version) || version != kVersion || !get(2, reserved) || !get(4, count)) return false;
+        map<string, Entry> parsed;
+        for (uint64_t i = 0; i < count; i++) {
+            string sid;
+            Entry entry;
+            if (!text(sid) || !text(entry.hivePath) || !get(8, entry.keyWrite) || !get(8, entry.stamp) || !get(8, entry.applied)) {
+                return false;
+            }
+            parsed[sid] = entry;
+        }
+        if (pos != end) return false;
+        entries = move(parsed);
+        return true;
+    }
+    
+public:
+    // A missing or unreadable index just starts empty; the next save rewrites it
+    bool open(const string& path) {
+        lock_guard<mutex> guard(lock);
+        file = path;
+        entries.clear();
+        dirty = false;
+        MappedFile mapped;
+        if (!mapped.open(path)) return false;
+        if (deserialize(mapped.data(), mapped.size())) return true;
+        entries.clear();
+        dirty = true;
+        return false;
+    }
+    
+    bool isOpen() const {
+        lock_guard<mutex> guard(lock);
+        return !file.empty();
+    }
+    
+    // Written to a temp file and renamed, like change plans
+    bool save() {
+        lock_guard<mutex> guard(lock);
+        if (file.empty() || !dirty) return true;
+        vector<uint8_t> bytes = serialize();
+        string temp = file + ".tmp";
+        {
+            ofstream out(temp, ios::binary | ios::trunc);
+            if (!out.is_open()) return false;
+            out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+            if (!out.good()) return false;
+        }
+        error_code ec;
+        fs::rename(temp, file, ec);
+        if (!ec) dirty = false;
+        return !ec;
+    }
+    
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return entries.size();
+    }
+    
+    // Cached hive path, valid while the SID key's last-write time is unchanged
+    bool cachedPath(const string& sid, uint64_t keyWrite, string& hivePath) const {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(sid);
+        if (it == entries.end() || it->second.keyWrite != keyWrite) return false;
+        hivePath = it->second.hivePath;
+        return true;
+    }
+    
+    void setPath(const string& sid, const string& hivePath, uint64_t keyWrite) {
+        lock_guard<mutex> guard(lock);
+        Entry& entry = entries[sid];
+        if (entry.hivePath != hivePath) entry.stamp = 0;
+        entry.hivePath = hivePath;
+        entry.keyWrite = keyWrite;
+        dirty = true;
+    }
+    
+    // Drop profiles that are no longer listed
+    void retain(const vector<string>& sids) {
+        lock_guard<mutex> guard(lock);
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (find(sids.begin(), sids.end(), it->first) == sids.end()) {
+                it = entries.erase(it);
+                dirty = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    bool compliant(const string& sid, uint64_t stamp, uint64_t applied) const {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(sid);
+        return stamp != 0 && it != entries.end() && it->second.stamp == stamp && it->second.applied == applied;
+    }
+    
+    void markCompliant(const string& sid, uint64_t stamp, uint64_t applied) {
+        lock_guard<mutex> guard(lock);
+        Entry& entry = entries[sid];
+        entry.stamp = stamp;
+        entry.applied = applied;
+        dirty = true;
+    }
+    
+    void invalidate(const string& sid) {
+        lock_guard<mutex> guard(lock);
+        auto it = entries.find(sid);
+        if (it == entries.end() || it->second.stamp == 0) return;
+        it->second.stamp = 0;
+        dirty = true;
+    }
+};
+
+#ifdef _WIN32
+struct UserProfile {
+    string sid;
+    string hivePath;    // NTUSER.DAT from ProfileList, empty if unknown
+    bool loaded = false;
+    bool pathOnly = false;  // a hive file no profile claims; sid is only a mount id
+    
+    // Who backups are filed under, so --rollback can find the hive again
+    string owner() const { return pathOnly ? hivePath : sid; }
+    
+    // A hive file named directly, e.g. on a manifest line
+    static UserProfile forHive(const string& hivePath) {
+        UserProfile profile;
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx",
+                 static_cast<unsigned long long>(fnv1a64(reinterpret_cast<const uint8_t*>(hivePath.data()), hivePath.size())));
+        profile.sid = string("hive-") + id;
+        profile.hivePath = hivePath;
+        profile.pathOnly = true;
+        return profile;
+    }
+};
+
+// Discovers user hives: those already loaded under HKEY_USERS plus, when
+// asked, offline profiles listed in ProfileList
+class ProfileEnumerator {
+public:
+    // Local and domain accounts (S-1-5-21-) and Azure AD accounts (S-1-12-1-);
+    // service and well-known SIDs are not user profiles
+    static bool isUserSid(const string& name) {
+        return (name.compare(0, 9, "S-1-5-21-") == 0 || name.compare(0, 9, "S-1-12-1-") == 0) &&
+               name.find("_Classes") == string::npos;
+    }
+    
+private:
+    
+    static vector<string> subKeyNames(HKEY key) {
+        vector<string> names;
+        for (const auto& entry : subKeys(key)) names.push_back(entry.first);
+        return names;
+    }
+    
+    // Subkey names with their last-write times, which RegEnumKeyEx returns
+    // for free; the profile index uses them to spot changed entries
+    static vector<pair<string, uint64_t>> subKeys(HKEY key) {
+        vector<pair<string, uint64_t>> keys;
+        WCHAR name[256];
+        for (DWORD index = 0;; index++) {
+            DWORD nameLen = 256;
+            FILETIME written = {};
+            LONG status = RegEnumKeyExW(key, index, name, &nameLen, NULL, NULL, NULL, &written);
+            if (status != ERROR_SUCCESS) break;
+            keys.emplace_back(utf16ToUtf8(reinterpret_cast<const char16_t*>(name), nameLen), fileTimeValue(written));
+        }
+        return keys;
+    }
+    
+    static string profileImagePath(HKEY profileList, const string& sid) {
+        RegistryKeyGuard keyGuard;
+        if (!keyGuard.openForRead(profileList, sid, KEY_QUERY_VALUE)) return string();
+        WCHAR raw[MAX_PATH];
+        DWORD size = sizeof(raw);
+        DWORD type = 0;
+        if (RegQueryValueExW(keyGuard.get(), L"ProfileImagePath", NULL, &type, reinterpret_cast<LPBYTE>(raw), &size) != ERROR_SUCCESS) {
+            return string();
+        }
+        raw[MAX_PATH - 1] = 0;
+        WCHAR expanded[MAX_PATH];
+        DWORD length = ExpandEnvironmentStringsW(raw, expanded, MAX_PATH);
+        if (length == 0 || length > MAX_PATH) return string();
+        return utf16ToUtf8(reinterpret_cast<const char16_t*>(expanded), length - 1);
+    }
+    
+public:
+    static uint64_t fileTimeValue(const FILETIME& time) {
+        return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    }
+    
+    // Last-write time of a key, 0 if it does not exist
+    static uint64_t keyWriteTime(HKEY root, const string& keyPath) {
+        RegistryKeyGuard keyGuard;
+        if (!keyGuard.openForRead(root, keyPath, KEY_QUERY_VALUE)) return 0;
+        FILETIME written = {};
+        if (RegQueryInfoKeyW(keyGuard.get(), NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, &written) != ERROR_SUCCESS) {
+            return 0;
+        }
+        return fileTimeValue(written);
+    }
+    
+    static uint64_t fileWriteTime(const string& path) {
+        u16string widePath = utf8ToUtf16(path);
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExW(reinterpret_cast<LPCWSTR>(widePath.c_str()), GetFileExInfoStandard, &attributes)) return 0;
+        return fileTimeValue(attributes.ftLastWriteTime);
+    }
+    
+    // SID of the user this process runs as, empty if the token says nothing
+    static string currentUserSid() {
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token)) return string();
+        string sid;
+        DWORD size = 0;
+        GetTokenInformation(token, TokenUser, NULL, 0, &size);
+        vector<uint8_t> buffer(size);
+        LPWSTR text = NULL;
+        if (size > 0 && GetTokenInformation(token, TokenUser, buffer.data(), size, &size) &&
+            ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(buffer.data())->User.Sid, &text)) {
+            sid = utf16ToUtf8(reinterpret_cast<const char16_t*>(text), char_traits<char16_t>::length(reinterpret_cast<const char16_t*>(text)));
+            LocalFree(text);
+        }
+        CloseHandle(token);
+        return sid;
+    }
+    
+    // RegLoadKey/RegUnLoadKey need the backup and restore privileges
+    static bool enablePrivilege(LPCWSTR name) {
+        HANDLE token;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+        TOKEN_PRIVILEGES privileges;
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool ok = LookupPrivilegeValueW(NULL, name, &privileges.Privileges[0].Luid) &&
+                  AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+                  GetLastError() == ERROR_SUCCESS;
+        CloseHandle(token);
+        return ok;
+    }
+    
+    // With an index, ProfileImagePath is only read for SID keys written since
+    // the index last saw them
+    static vector<UserProfile> enumerate(bool includeOffline, ProfileIndex* index = nullptr) {
+        vector<UserProfile> profiles;
+        for (const auto& name : subKeyNames(HKEY_USERS)) {
+            if (isUserSid(name)) {
+                UserProfile profile;
+                profile.sid = name;
+                profile.loaded = true;
+                profiles.push_back(profile);
+            }
+        }
+        
+        RegistryKeyGuard profileList;
+        if (!profileList.openForRead(HKEY_LOCAL_MACHINE, "SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion\\ProfileList")) {
+            return profiles;
+        }
+        vector<string> listed;
+        for (const auto& key : subKeys(profileList.get())) {
+            const string& sid = key.first;
+            if (!isUserSid(sid)) continue;
+            listed.push_back(sid);
+            string hivePath;
+            if (index == nullptr || !index->cachedPath(sid, key.second, hivePath)) {
+                string imagePath = profileImagePath(profileList.get(), sid);
+                hivePath = imagePath.empty() ? string() : imagePath + "\\NTUSER.DAT";
+                if (index != nullptr) index->setPath(sid, hivePath, key.second);
+            }
+            auto existing = find_if(profiles.begin(), profiles.end(), [&](const UserProfile& p) { return p.sid == sid; });
+            if (existing != profiles.end()) {
+                existing->hivePath = hivePath;
+            } else if (includeOffline && !hivePath.empty()) {
+                UserProfile profile;
+                profile.sid = sid;
+                profile.hivePath = hivePath;
+                profiles.push_back(profile);
+            }
+        }
+        if (index != nullptr) index->retain(listed);
+        return profiles;
+    }
+};
+
+// Opens a profile hive as an apply root, mounting offline NTUSER.DAT files
+// under HKEY_USERS for the lifetime of the object
+class ProfileHive {
+private:
+    HKEY root;
+    string mountName;
+    bool mounted;
+    
+public:
+    ProfileHive() : root(NULL), mounted(false) {}
+    
+    LONG open(const UserProfile& profile) {
+        string keyName = profile.sid;
+        if (!profile.loaded) {
+            mountName = "RegionalReset_" + profile.sid;
+            u16string wideMount = utf8ToUtf16(mountName);
+            u16string wideHive = utf8ToUtf16(profile.hivePath);
+            LONG status = RegLoadKeyW(HKEY_USERS, reinterpret_cast<LPCWSTR>(wideMount.c_str()), reinterpret_cast<LPCWSTR>(wideHive.c_str()));
+            if (status != ERROR_SUCCESS) return status;
+            mounted = true;
+            keyName = mountName;
+        }
+        u16string wideKey = utf8ToUtf16(keyName);
+        return RegOpenKeyExW(HKEY_USERS, reinterpret_cast<LPCWSTR>(wideKey.c_str()), 0, KEY_READ | KEY_WRITE, &root);
+    }
+    
+    RegistryTarget target(const UserProfile& profile) const {
+        return {root, "HKEY_USERS\\" + (mounted ? mountName : profile.sid), profile.owner()};
+    }
+    
+    ~ProfileHive() {
+        if (root != NULL) RegCloseKey(root);
+        if (mounted) {
+            u16string wideMount = utf8ToUtf16(mountName);
+            RegUnLoadKeyW(HKEY_USERS, reinterpret_cast<LPCWSTR>(wideMount.c_str()));
+        }
+    }
+    
+    ProfileHive(const ProfileHive&) = delete;
+    ProfileHive& operator=(const ProfileHive&) = delete;
+};
+
+// HKEY_USERS of another machine over one RegConnectRegistry connection.
+// Every profile on the host is reached through this single handle, so the
+// host costs one RPC binding however many users it has.
+class RemoteRegistry {
+private:
+    // Shared with the connecting thread, which may outlive a timed-out caller
+    struct Attempt {
+        mutex lock;
+        condition_variable ready;
+        bool done = false;
+        bool abandoned = false;
+        HKEY key = NULL;
+        LONG status = ERROR_SUCCESS;
+    };
+    
+    HKEY users;
+    
+public:
+    RemoteRegistry() : users(NULL) {}
+    
+    // RegConnectRegistry has no timeout of its own; an unreachable host can
+    // stall for the full RPC timeout, so the wait is bounded here
+    LONG connect(const string& host, chrono::milliseconds timeout) {
+        auto attempt = make_shared<Attempt>();
+        u16string machine = utf8ToUtf16(host.compare(0, 2, "\\\\") == 0 ? host : "\\\\" + host);
+        thread([attempt, machine] {
+            HKEY key = NULL;
+            LONG status = RegConnectRegistryW(reinterpret_cast<LPCWSTR>(machine.c_str()), HKEY_USERS, &key);
+            lock_guard<mutex> guard(attempt->lock);
+            if (attempt->abandoned) {
+                if (status == ERROR_SUCCESS) RegCloseKey(key);
+                return;
+            }
+            attempt->key = key;
+            attempt->status = status;
+            attempt->done = true;
+            attempt->ready.notify_one();
+        }).detach();
+        
+        unique_lock<mutex> guard(attempt->lock);
+        if (!attempt->ready.wait_for(guard, timeout, [&attempt] { return attempt->done; })) {
+            attempt->abandoned = true;
+            return ERROR_TIMEOUT;
+        }
+        if (attempt->status == ERROR_SUCCESS) users = attempt->key;
+        return attempt->status;
+    }
+    
+    // SIDs of the interactive users whose hives are loaded on the host
+    vector<string> loadedUsers() const {
+        vector<string> sids;
+        WCHAR name[256];
+        for (DWORD index = 0;; index++) {
+            DWORD nameLen = 256;
+            if (RegEnumKeyExW(users, index, name, &nameLen, NULL, NULL, NULL, NULL) != ERROR_SUCCESS) break;
+            string sid = utf16ToUtf8(reinterpret_cast<const char16_t*>(name), nameLen);
+            if (ProfileEnumerator::isUserSid(sid)) sids.push_back(sid);
+        }
+        return sids;
+    }
+    
+    HKEY get() const { return users; }
+    
+    ~RemoteRegistry() {
+        if (users != NULL) RegCloseKey(users);
+    }
+    
+    RemoteRegistry(const RemoteRegistry&) = delete;
+    RemoteRegistry& operator=(const RemoteRegistry&) = delete;
+};
+#endif
+
+// Fixed-size pool where every worker owns a deque of tasks. Workers pop
+// their own queue from the back and steal from the front of their
+// siblings', so one slow profile never leaves the other threads idle.
+class WorkStealingPool {
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+    atomic<size_t> queued;
+    atomic<size_t> pending;
+    atomic<size_t> nextQueue;
+    atomic<bool> stopping;
+    mutex idleMutex;
+    condition_variable idleCv;
+    mutex doneMutex;
+    condition_variable doneCv;
+    bool tryTake(size_t self, function<void()>& task) {
+        {
+            WorkQueue& own = *queues[self];
+            lock_guard<mutex> lock(own.lock);
+            if (!own.tasks.empty()) {
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            WorkQueue& victim = *queues[(self + offset) % queues.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void run(size_t self) {
+        for (;;) {
+            function<void()> task;
+            if (tryTake(self, task)) {
+                queued--;
+                task();
+                if (--pending == 0) {
+                    lock_guard<mutex> lock(doneMutex);
+                    doneCv.notify_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(idleMutex);
+            if (stopping.load()) return;
+            idleCv.wait_for(lock, chrono::milliseconds(50), [this] {
+                return stopping.load() || queued.load() > 0;
+            });
+        }
+    }
+    
+public:
+    explicit WorkStealingPool(size_t threadCount) : queued(0), pending(0), nextQueue(0), stopping(false) {
+        if (threadCount == 0) threadCount = 1;
+        for (size_t i = 0; i < threadCount; i++) {
+            queues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+        }
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back(&WorkStealingPool::run, this, i);
+        }
+    }
+    
+    ~WorkStealingPool() {
+        wait();
+        {
+            lock_guard<mutex> lock(idleMutex);
+            stopping = true;
+        }
+        idleCv.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+    
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    
+    void submit(function<void()> task) {
+        pending++;
+        WorkQueue& target = *queues[nextQueue++ % queues.size()];
+        {
+            lock_guard<mutex> lock(target.lock);
+            target.tasks.push_back(move(task));
+        }
+        queued++;
+        lock_guard<mutex> lock(idleMutex);
+        idleCv.notify_one();
+    }
+    
+    // Block until every submitted task has finished
+    void wait() {
+        unique_lock<mutex> lock(doneMutex);
+        doneCv.wait(lock, [this] { return pending.load() == 0; });
+    }
+    
+    size_t size() const { return workers.size(); }
+};
+
+// Blocking FIFO with a fixed capacity. push() waits while the queue is
+// full, which is the backpressure that keeps a fast stage from running
+// arbitrarily far ahead of a slow one.
+template <typename T>
+class BoundedQueue {
+private:
+    mutex lock;
+    condition_variable notFull;
+    condition_variable notEmpty;
+    deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(max<size_t>(1, capacity)) {}
+    
+    void push(T item) {
+        unique_lock<mutex> guard(lock);
+        notFull.wait(guard, [this] { return items.size() < capacity; });
+        items.push_back(move(item));
+        notEmpty.notify_one();
+    }
+    
+    // False once the queue is closed and drained
+    bool pop(T& item) {
+        unique_lock<mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    
+    void close() {
+        lock_guard<mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+    }
+};
+
+// Stages on their own threads, connected by bounded queues, so job N+1 can
+// be in an early stage while job N is in a later one. Each job still passes
+// through the stages in order. Throughput is set by the slowest stage, and
+// the queue depth bounds how many jobs are in flight between stages. A step
+// returning false finishes its job early; done() sees every job exactly
+// once, on the thread that finished it.
+template <typename Job>
+class StagePipeline {
+public:
+    using Step = function<bool(Job&)>;
+    
+    struct StageStats {
+        string name;
+        size_t threads = 0;
+        size_t jobs = 0;
+        chrono::microseconds busy{0};   // summed over the stage's threads
+    };
+    
+private:
+    struct Stage {
+        string name;
+        size_t threads;
+        Step step;
+        atomic<size_t> jobs{0};
+        atomic<long long> busyUs{0};
+    };
+    
+    size_t depth;
+    vector<unique_ptr<Stage>> stages;
+    
+public:
+    explicit StagePipeline(size_t depth) : depth(depth) {}
+    
+    void stage(const string& name, size_t threads, Step step) {
+        unique_ptr<Stage> added(new Stage());
+        added->name = name;
+        added->threads = max<size_t>(1, threads);
+        added->step = move(step);
+        stages.push_back(move(added));
+    }
+    
+    // Feed jobs in from the calling thread (blocking while the first queue
+    // is full) and return once every job has been handed to done()
+    void run(vector<unique_ptr<Job>> jobs, const function<void(Job&)>& done) {
+        if (stages.empty()) {
+            for (auto& job : jobs) done(*job);
+            return;
+        }
+        vector<unique_ptr<BoundedQueue<unique_ptr<Job>>>> queues;
+        for (size_t i = 0; i < stages.size(); i++) {
+            queues.emplace_back(new BoundedQueue<unique_ptr<Job>>(depth));
+        }
+        vector<unique_ptr<atomic<size_t>>> running;
+        vector<thread> threads;
+        for (size_t i = 0; i < stages.size(); i++) {
+            running.emplace_back(new atomic<size_t>(stages[i]->threads));
+            for (size_t t = 0; t < stages[i]->threads; t++) {
+                threads.emplace_back([this, i, &queues, &running, &done] {
+                    Stage& current = *stages[i];
+                    bool last = i + 1 == stages.size();
+                    unique_ptr<Job> job;
+                    while (queues[i]->pop(job)) {
+                        auto started = chrono::steady_clock::now();
+                        bool keep = false;
+                        try {
+                            keep = current.step(*job);
+                        } catch (const exception&) {
+                            keep = false;   // steps report their own errors
+                        }
+                        current.busyUs += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+                        current.jobs++;
+                        if (keep && !last) {
+                            queues[i + 1]->push(move(job));
+                        } else {
+                            done(*job);
+                            job.reset();
+                        }
+                    }
+                    if (--*running[i] == 0 && !last) queues[i + 1]->close();
+                });
+            }
+        }
+        for (auto& job : jobs) queues[0]->push(move(job));
+        queues[0]->close();
+        for (auto& worker : threads) worker.join();
+    }
+    
+    vector<StageStats> stats() const {
+        vector<StageStats> out;
+        for (const auto& entry : stages) {
+            StageStats stats;
+            stats.name = entry->name;
+            stats.threads = entry->threads;
+            stats.jobs = entry->jobs.load();
+            stats.busy = chrono::microseconds(entry->busyUs.load());
+            out.push_back(stats);
+        }
+        return out;
+    }
+};
+
+class RegionalSettingsManager {
+private:
+    shared_ptr<const Config> configSnapshot = make_shared<const Config>();    // RCU: read via currentConfig()
+    Logger logger;
+    BackupStore backupStore;
+    atomic<int> operationCount;
+    atomic<int> successCount;
+    atomic<int> errorCount;
+    CatalogLocaleProvider catalogLocales;
+    BuiltinLocaleProvider builtinLocales;
+    SystemLocaleProvider systemLocales;
+    LocaleResolver resolver;
+    mutex encodedBatchesMutex;
+    map<string, shared_ptr<const RegistryBatch>> encodedBatches;    // UTF-16 batches per locale tag
+    bool headless = false;
+    chrono::steady_clock::time_point launchTime;
+    vector<pair<string, chrono::microseconds>> startupPhases;
+    once_flag localesLoaded;
+    atomic<long long> localeLoadUs{0};
+    atomic<bool> startupReported{false};
+    atomic<int> profilesUpdated{0};
+    atomic<int> profilesCompliant{0};
+    atomic<int> profilesFailed{0};
+    mutex profileResultsMutex;
+    vector<string> failedProfiles;
+    ProfileIndex profileIndex;
+    atomic<int> profilesIndexed{0};     // skipped as unchanged since their last compliant apply
+    atomic<int> retriesScheduled{0};
+    atomic<int> retriesRecovered{0};    // succeeded on a later attempt
+    atomic<int> retriesExhausted{0};    // still transient after max_retries
+    atomic<long long> retryBackoffMs{0};
+    
+    string getCurrentTimestamp() {
+        auto now = time(nullptr);
+        auto tm = localTime(now);
+        stringstream ss;
+        ss << put_time(&tm, "%Y%m%d_%H%M%S");
+        return ss.str();
+    }
+    
+    bool loadConfig(const string& configFile = "config.json") {
+        ifstream file(configFile, ios::binary);
+        if (!file.is_open()) {
+            logger.warn("Config file not found: {}, using defaults", configFile);
+            return false;
+        }
+        
+        Config parsed = *currentConfig();
+        ConfigJsonHandler handler(parsed);
+        JsonReader reader(file);
+        if (!reader.parse(handler)) {
+            logger.warn("Invalid config file {} ({}), using defaults", configFile, reader.lastError());
+            return false;
+        }
+        logger.setAsync(parsed.async_logging);
+        LogLevel level;
+        if (Logger::parseLevel(parsed.log_level, level)) {
+            logger.setMinLevel(level);
+        } else {
+            logger.warn("Unknown log_level '{}', using info", parsed.log_level);
+        }
+        publishConfig(move(parsed));
+        
+        logger.info("Configuration loaded successfully");
+        return true;
+    }
+    
+    // The configuration in force. Callers keep the returned snapshot for as
+    // long as they read it, so a reload never changes values under them.
+    shared_ptr<const Config> currentConfig() const {
+        return atomic_load(&configSnapshot);
+    }
+    
+    // Each operation times itself in its own monitor, so concurrent
+    // operations never share a start time or phase list
+    PerformanceMonitor startOperation() const {
+        PerformanceMonitor perf;
+        perf.setReportPath(currentConfig()->perf_report_path);
+        perf.start();
+        return perf;
+    }
+    
+    // Replace the whole snapshot; it is never modified after publication
+    void publishConfig(Config next) {
+        atomic_store(&configSnapshot, shared_ptr<const Config>(make_shared<Config>(move(next))));
+    }
+    
+    // Map the precompiled catalog; stale or missing catalogs fall back to JSON
+    bool loadCatalog(LocaleTables& tables) {
+        shared_ptr<const Config> config = currentConfig();
+        if (config->locale_catalog.empty()) return false;
+        if (!tables.catalog.open(config->locale_catalog, "custom_locales.json", kBuiltinLocalesHash)) return false;
+        logger.info("Loaded locale catalog: {} ({} locales)", config->locale_catalog, tables.catalog.size());
+        return true;
+    }
+    
+    void reloadLocales() {
+        auto tables = make_shared<LocaleTables>();
+        if (!loadCatalog(*tables)) {
+            loadCustomLocales(*tables);
+        }
+        catalogLocales.publish(move(tables));
+    }
+    
+    // Re-read config.json and the locale sources and publish them as new
+    // snapshots. Operations already running finish on the snapshots they
+    // pinned, which are freed when the last of them is done.
+    void reloadSettings() {
+        ensureLocales();
+        loadConfig();
+        republishLocales();
+    }
+    
+    void republishLocales() {
+        reloadLocales();
+        resolver.clear();
+        lock_guard<mutex> lock(encodedBatchesMutex);
+        encodedBatches.clear();
+    }
+    
+    // Size and mtime of every settings source, to notice edits while resident
+    uint64_t settingsStamp() const {
+        uint64_t stamp = 14695981039346656037ull;
+        for (const string& path : {string("config.json"), string("custom_locales.json"), currentConfig()->locale_catalog}) {
+            auto source = LocaleCatalog::sourceStamp(path);
+            stamp = fnv1a64(reinterpret_cast<const uint8_t*>(&source.first), sizeof(source.first), stamp);
+            stamp = fnv1a64(reinterpret_cast<const uint8_t*>(&source.second), sizeof(source.second), stamp);
+        }
+        return stamp;
+    }
+    
+    // The catalog or custom_locales.json, read on the first lookup rather
+    // than at startup
+    void ensureLocales() {
+        call_once(localesLoaded, [this] {
+            auto begin = chrono::steady_clock::now();
+            reloadLocales();
+            loadSystemLocales();
+            localeLoadUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+        });
+    }
+    
+    void markStartup(const string& phase, chrono::steady_clock::time_point begin) {
+        startupPhases.emplace_back(phase, chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin));
+    }
+    
+    // Startup phases go into every operation's performance summary; the
+    // breakdown is logged once, at info level in headless mode
+    void reportStartup(PerformanceMonitor& perf) {
+        shared_ptr<const Config> config = currentConfig();
+        vector<pair<string, chrono::microseconds>> phases = startupPhases;
+        phases.emplace_back("locales", chrono::microseconds(localeLoadUs.load()));
+        for (const auto& phase : phases) {
+            perf.record("startup_" + phase.first, phase.second);
+        }
+        if (startupReported.exchange(true)) return;
+        
+        auto ready = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - launchTime);
+        string breakdown;
+        for (const auto& phase : phases) {
+            breakdown += (breakdown.empty() ? "" : ", ") + phase.first + " " + PerformanceMonitor::formatMicros(phase.second);
+        }
+        if (headless) {
+            logger.info("Startup: {} to first operation ({})", PerformanceMonitor::formatMicros(ready), breakdown);
+        } else {
+            logger.debug("Startup: {} to first operation ({})", PerformanceMonitor::formatMicros(ready), breakdown);
+        }
+        if (config->startup_budget_ms > 0 && ready > chrono::milliseconds(config->startup_budget_ms)) {
+            logger.warn("Startup took {}, over the {} ms budget", PerformanceMonitor::formatMicros(ready), config->startup_budget_ms);
+        }
+    }
+    
+    // Map the OS locale cache, or build it in the background for the next run
+    void loadSystemLocales() {
+        shared_ptr<const Config> config = currentConfig();
+        if (config->system_locale_cache.empty()) return;
+        if (systemLocales.open(config->system_locale_cache)) {
+            logger.info("Loaded OS locale cache: {} ({} locales)", config->system_locale_cache, systemLocales.cachedCount());
+        } else if (systemLocales.prefetch(config->system_locale_cache, logger)) {
+            logger.debug("Building OS locale cache {} in the background", config->system_locale_cache);
+        }
+    }
+    
+    // Applicable locales in precedence order; the OS locales are kept apart
+    // and only reached through the resolver
+    vector<const LocaleProvider*> tableProviders() const {
+        return {&catalogLocales, &builtinLocales};
+    }
+    
+    bool findLocale(const string& tag, PinnedLocale& out) const {
+        for (const LocaleProvider* provider : tableProviders()) {
+            if (provider->find(tag, out)) return true;
+        }
+        return false;
+    }
+    
+    bool resolveLocale(const string& requested, string& tag, PinnedLocale& info) {
+        LocaleResolver::Resolution resolution = resolver.resolve(requested);
+        if (!resolution.found) return false;
+        if (resolution.tag != requested) {
+            logger.info("Resolved locale {} to {} ({})", requested, resolution.tag, resolution.via);
+        }
+        tag = resolution.tag;
+        info = resolution.view;
+        return true;
+    }
+    
+    // Point at the nearest known tags rather than printing the whole table
+    void reportUnsupported(const string& requested) {
+        logger.error("Unsupported locale: {}", requested);
+        vector<string> close = resolver.suggest(requested);
+        if (close.empty()) {
+            cout << "Use --help to list the supported locales.\n";
+            return;
+        }
+        string hint;
+        for (const auto& tag : close) hint += (hint.empty() ? "" : ", ") + tag;
+        cout << "Did you mean: " << hint << "?\n";
+    }
+    
+    // Every locale the resolver can choose from, sorted by tag; a tag
+    // provided more than once comes from the earliest provider
+    vector<PinnedLocale> allLocales() const {
+        return mergeLocales(tableProviders());
+    }
+    
+    // The built-in table and custom_locales.json alone, read into a private
+    // snapshot: neither the published locales nor the lazy load are touched
+    vector<PinnedLocale> loadSourceLocales() {
+        auto sources = make_shared<LocaleTables>();
+        loadCustomLocales(*sources);
+        CatalogLocaleProvider custom;
+        custom.publish(move(sources));
+        return mergeLocales({&custom, &builtinLocales});
+    }
+    
+    static vector<PinnedLocale> mergeLocales(const vector<const LocaleProvider*>& providers) {
+        vector<PinnedLocale> locales;
+        unordered_set<string_view> seen;
+        for (const LocaleProvider* provider : providers) {
+            for (const auto& locale : provider->locales()) {
+                if (seen.insert(locale.tag).second) locales.push_back(locale);
+            }
+        }
+        sort(locales.begin(), locales.end(), [](const PinnedLocale& a, const PinnedLocale& b) { return a.tag < b.tag; });
+        return locales;
+    }
+    
+    bool loadCustomLocales(LocaleTables& tables, const string& customFile = "custom_locales.json") {
+        ifstream file(customFile, ios::binary);
+        if (!file.is_open()) {
+            logger.info("No custom locales file found: {}", customFile);
+            return false;
+        }
+        
+        vector<pair<string, LocaleInfo>> loaded;
+        CustomLocalesJsonHandler handler(loaded);
+        JsonReader reader(file);
+        if (!reader.parse(handler)) {
+            logger.warn("Invalid custom locales file {} ({})", customFile, reader.lastError());
+            return false;
+        }
+        
+        for (const auto& locale : loaded) {
+            if (locale.second.name.empty() || locale.second.shortDate.empty()) {
+                logger.warn("Skipping incomplete custom locale: {}", locale.first);
+                continue;
+            }
+            tables.custom[locale.first] = locale.second;
+            logger.info("Loaded custom locale: {}", locale.first);
+        }
+        
+        return true;
+    }
+    
+#ifdef _WIN32
+    // Persist a backup of keyPath; a snapshot already read by the diff engine
+    // is saved as-is instead of reading the registry again
+    bool backupRegistry(const Config& config, const RegistryTarget& target, const string& keyPath,
+                        const RegistrySnapshot* captured = nullptr) {
+        if (!config.backup_enabled) return true;
+        
+        RegistrySnapshot snapshot;
+        if (captured != nullptr) {
+            snapshot = *captured;
+        } else if (!NativeBackup::capture(target.root, keyPath, snapshot)) {
+            logger.warn("Failed to backup: {}\\{}", target.rootName, keyPath);
+            return false;
+        }
+        
+        string scope = (target.label.empty() ? target.rootName : target.label) + "\\" + keyPath;
+        string id = backupStore.commit(snapshot, scope);
+        bool saved = !id.empty();
+        if (saved && (config.backup_format == "reg" || config.backup_format == "both")) {
+            error_code ec;
+            fs::create_directories(backupStore.path() + "/exports", ec);
+            saved = NativeBackup::exportRegText(snapshot, target.rootName, backupStore.path() + "/exports/" + id + ".reg");
+        }
+        
+        if (saved) {
+            logger.info("Backed up: {}\\{} ({} values, snapshot {})", target.rootName, keyPath, snapshot.valueCount(), id);
+            return true;
+        } else {
+            logger.warn("Failed to backup: {}\\{}", target.rootName, keyPath);
+            string damage = backupStore.damage();
+            if (!damage.empty()) {
+                logger.error("Backup archive {}/objects.pack is read-only ({}); the file was left untouched", backupStore.path(), damage);
+            }
+            return false;
+        }
+    }
+#endif
+    
+    struct ApplyOutcome {
+        enum Status { Applied, Compliant, Cancelled, Failed };
+        Status status = Failed;
+        size_t changed = 0;
+        bool rolledBack = false;
+        bool transient = false;     // Failed, but RetryPolicy says try again
+        bool complete = true;       // false if an extended settings subsystem failed
+    };
+    
+    // Settings outside International, each handled by its own worker
+    struct SubsystemResult {
+        string name;
+        size_t changed = 0;
+        bool ok = true;
+        vector<string> preview;     // demo mode: what would be written
+    };
+    
+    // Clearing User Profile and the MRU lists deletes data Windows rebuilds on
+    // its own, so both are opt-in; a hive is never compliant with a clear
+    static bool hasExtendedSettings(const Config& config) {
+        return config.feature("reset_windows11_memory") || config.feature("reset_office_settings") ||
+               config.feature("clear_user_profile_cache") || config.feature("reset_mru_lists");
+    }
+    
+    static constexpr const char* kUserProfileKey = "Control Panel\\International\\User Profile";
+    static constexpr const char* kMruKeys[] = {
+        "Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\RunMRU",
+        "Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\TypedPaths",
+        "Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\WordWheelQuery",
+        "Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\RecentDocs"
+    };
+    
+#ifdef _WIN32
+    // Current values of every key a batch touches, one read per key
+    static RegistrySnapshot readLiveValues(HKEY root, const RegistryBatch& batch) {
+        RegistrySnapshot live;
+        for (const auto& key : batch.entries()) {
+            RegistrySnapshot keyValues;
+            if (NativeBackup::captureValues(root, key.first, keyValues)) {
+                live.keys.insert(live.keys.end(), keyValues.keys.begin(), keyValues.keys.end());
+            }
+        }
+        return live;
+    }
+    
+    // Same for every key of a snapshot, tombstone-only keys included
+    static RegistrySnapshot readLiveValues(HKEY root, const RegistrySnapshot& snapshot) {
+        RegistrySnapshot live;
+        for (const auto& key : snapshot.keys) {
+            RegistrySnapshot keyValues;
+            if (NativeBackup::captureValues(root, key.path, keyValues)) {
+                live.keys.insert(live.keys.end(), keyValues.keys.begin(), keyValues.keys.end());
+            }
+        }
+        return live;
+    }
+    
+    // What a User Profile clear would delete; false when there is nothing
+    static bool captureUserProfile(const RegistryTarget& target, RegistrySnapshot& snapshot) {
+        if (!NativeBackup::capture(target.root, kUserProfileKey, snapshot)) return false;
+        return snapshot.keys.size() > 1 || snapshot.valueCount() > 0;
+    }
+    
+    // Every value the MRU clear would delete, grouped by key
+    static RegistrySnapshot captureMruValues(const RegistryTarget& target) {
+        RegistrySnapshot cleared;
+        for (const char* mruKey : kMruKeys) {
+            RegistrySnapshot values;
+            if (NativeBackup::captureValues(target.root, mruKey, values) && values.valueCount() > 0) {
+                cleared.keys.insert(cleared.keys.end(), values.keys.begin(), values.keys.end());
+            }
+        }
+        return cleared;
+    }
+#endif
+    
+    static RegistryBatch geoBatch(const LocaleIds& ids) {
+        RegistryBatch batch;
+        batch.set("Control Panel\\International\\Geo", "Nation", to_string(ids.geoId));
+        return batch;
+    }
+    
+    // Only Office versions/apps that already have an Options key are touched
+    static RegistryBatch officeBatch(const RegistryTarget& target, const LocaleIds& ids) {
+        static const char* const versions[] = {"15.0", "16.0"};
+        static const char* const apps[] = {"Word", "Excel", "PowerPoint", "Outlook"};
+        RegistryBatch batch;
+        for (const char* version : versions) {
+            for (const char* app : apps) {
+                string optionsKey = string("Software\\Microsoft\\Office\\") + version + "\\" + app + "\\Options";
+#ifdef _WIN32
+                RegistryKeyGuard probe;
+                if (!probe.openForRead(target.root, optionsKey, KEY_QUERY_VALUE)) continue;
+#else
+                (void)target;
+                if (string(version) != "16.0") continue;
+#endif
+                batch.set(optionsKey, "LOCALE_IDEFAULTLANGUAGE", to_string(ids.lcid), REG_DWORD);
+                batch.set(optionsKey, "LOCALE_IDEFAULTLOCALE", to_string(ids.lcid), REG_DWORD);
+            }
+        }
+        return batch;
+    }
+    
+#ifdef _WIN32
+    // Whether any enabled subsystem would change target. Geo and Office are
+    // diffed like International; the clears count only when something is
+    // left to clear.
+    static bool extendedSettingsPending(const Config& config, const RegistryTarget& target, const string& locale) {
+        LocaleIds ids = resolveLocaleIds(locale);
+        auto differs = [&target](const RegistryBatch& batch) {
+            return !RegistryDiff::delta(batch, readLiveValues(target.root, batch)).empty();
+        };
+        if (config.feature("reset_windows11_memory") && ids.geoId != 0 && differs(geoBatch(ids))) return true;
+        if (config.feature("reset_office_settings") && ids.lcid != 0 && differs(officeBatch(target, ids))) return true;
+        RegistrySnapshot profile;
+        if (config.feature("clear_user_profile_cache") && captureUserProfile(target, profile)) return true;
+        return config.feature("reset_mru_lists") && !captureMruValues(target).keys.empty();
+    }
+#endif
+    
+    // Write only the differing values of batch, backing up what they replace
+    SubsystemResult applySubsystemBatch(const Config& config, const RegistryTarget& target, const string& name,
+                                        const string& backupKey, RegistryBatch batch) {
+        SubsystemResult result;
+        result.name = name;
+#ifdef _WIN32
+        RegistrySnapshot current = readLiveValues(target.root, batch);
+        batch = RegistryDiff::delta(batch, current);
+        if (batch.empty()) return result;
+        if (config.backup_enabled) {
+            RegistrySnapshot overwritten = RegistryDiff::affected(current, batch);
+            if (!overwritten.keys.empty() && !backupRegistry(config, target, backupKey, &overwritten)) {
+                logger.error("Skipping {} settings in {}: backup failed", name, target.rootName);
+                result.ok = false;
+                return result;
+            }
+        }
+        RegistryBatch::Result written = batch.apply(logger, transactional(config, target), target.root);
+        result.changed = written.applied;
+        result.ok = written.failed == 0;
+#else
+        (void)config;
+        (void)target;
+        (void)backupKey;
+        for (const auto& key : batch.entries()) {
+            for (const auto& write : key.second) {
+                result.preview.push_back("  " + key.first + "\\" + write.valueName + " = " + RegistryBatch::describe(write));
+            }
+        }
+        result.changed = batch.size();
+#endif
+        return result;
+    }
+    
+    SubsystemResult resetGeo(const Config& config, const RegistryTarget& target, const LocaleIds& ids) {
+        return applySubsystemBatch(config, target, "Geo", "Control Panel\\International\\Geo", geoBatch(ids));
+    }
+    
+    SubsystemResult resetOffice(const Config& config, const RegistryTarget& target, const LocaleIds& ids) {
+        return applySubsystemBatch(config, target, "Office", "Software\\Microsoft\\Office", officeBatch(target, ids));
+    }
+    
+    // Drop the cached per-language data under International\User Profile
+    SubsystemResult resetUserProfile(const Config& config, const RegistryTarget& target) {
+        SubsystemResult result;
+        result.name = "User Profile";
+        const string profileKey = kUserProfileKey;
+#ifdef _WIN32
+        RegistrySnapshot snapshot;
+        if (!captureUserProfile(target, snapshot)) return result;
+        if (config.backup_enabled && !backupRegistry(config, target, profileKey, &snapshot)) {
+            logger.error("Not clearing {}\\{}: backup failed", target.rootName, profileKey);
+            result.ok = false;
+            return result;
+        }
+        u16string wideKey = utf8ToUtf16(profileKey);
+        LONG status = RegDeleteTreeW(target.root, reinterpret_cast<LPCWSTR>(wideKey.c_str()));
+        if (status == ERROR_SUCCESS) {
+            result.changed = snapshot.valueCount();
+        } else {
+            result.ok = false;
+            logger.warn("Failed to clear {}\\{} (Error: {})", target.rootName, profileKey, status);
+        }
+#else
+        (void)target;
+        (void)config;
+        result.preview.push_back("  " + profileKey + " (cleared)");
+#endif
+        return result;
+    }
+    
+    SubsystemResult clearMruLists(const Config& config, const RegistryTarget& target) {
+        SubsystemResult result;
+        result.name = "MRU";
+#ifdef _WIN32
+        RegistrySnapshot cleared = captureMruValues(target);
+        if (cleared.keys.empty()) return result;
+        if (config.backup_enabled &&
+            !backupRegistry(config, target, "Software\\Microsoft\\Windows\\CurrentVersion\\Explorer", &cleared)) {
+            logger.error("Not clearing MRU lists in {}: backup failed", target.rootName);
+            result.ok = false;
+            return result;
+        }
+        size_t failed = 0;
+        result.changed = NativeBackup::removeValues(target.root, cleared, failed);
+        result.ok = failed == 0;
+#else
+        (void)target;
+        (void)config;
+        for (const char* mruKey : kMruKeys) {
+            result.preview.push_back("  " + string(mruKey) + " (all values removed)");
+        }
+#endif
+        return result;
+    }
+    
+    // Run every enabled subsystem concurrently and join them. Each worker
+    // opens its own keys, so nothing but the logger is shared. complete is
+    // cleared when any subsystem fails or only partly applies.
+    size_t applyExtendedSettings(const Config& config, const RegistryTarget& target, const string& locale, bool& complete) {
+        LocaleIds ids = resolveLocaleIds(locale);
+        vector<future<SubsystemResult>> workers;
+        if (config.feature("reset_windows11_memory")) {
+            if (ids.geoId != 0) {
+                workers.push_back(async(launch::async, [this, &config, &target, ids] { return resetGeo(config, target, ids); }));
+            } else {
+                logger.info("No GeoID known for {}, skipping International\\Geo", locale);
+            }
+        }
+        if (config.feature("clear_user_profile_cache")) {
+            workers.push_back(async(launch::async, [this, &config, &target] { return resetUserProfile(config, target); }));
+        }
+        if (config.feature("reset_office_settings")) {
+            if (ids.lcid != 0) {
+                workers.push_back(async(launch::async, [this, &config, &target, ids] { return resetOffice(config, target, ids); }));
+            } else {
+                logger.info("No LCID known for {}, skipping Office settings", locale);
+            }
+        }
+        if (config.feature("reset_mru_lists")) {
+            workers.push_back(async(launch::async, [this, &config, &target] { return clearMruLists(config, target); }));
+        }
+        
+        size_t changed = 0;
+        for (auto& worker : workers) {
+            SubsystemResult result;
+            try {
+                result = worker.get();
+            } catch (const exception& e) {
+                logger.warn("Extended settings worker failed in {}: {}", target.rootName, e.what());
+                complete = false;
+                continue;
+            }
+            changed += result.changed;
+            for (const auto& line : result.preview) {
+                cout << line << "\n";
+            }
+            if (!result.ok) {
+                complete = false;
+                logger.warn("{} settings partially applied in {}", result.name, target.rootName);
+            } else if (result.changed > 0) {
+                logger.info("{} settings: {} value(s) changed in {}", result.name, result.changed, target.rootName);
+            }
+        }
+        return changed;
+    }
+    
+    // KTM transactions cannot cover keys opened through RegConnectRegistry
+    static bool transactional(const Config& config, const RegistryTarget& target) {
+        return config.transactional_writes && !target.remote;
+    }
+    
+    // localeBatch, encoded once per locale until the next reload. A caller
+    // keeps its batch alive across a reload by holding the pointer.
+    shared_ptr<const RegistryBatch> encodedLocaleBatch(const string& locale, const LocaleView& info) {
+        lock_guard<mutex> lock(encodedBatchesMutex);
+        auto it = encodedBatches.find(locale);
+        if (it == encodedBatches.end()) {
+            it = encodedBatches.emplace(locale, make_shared<const RegistryBatch>(localeBatch(locale, info))).first;
+        }
+        return it->second;
+    }
+    
+    // Decide whether a transient failure gets another attempt and, if so,
+    // how long it waits. Zero means give up (permanent, or out of retries).
+    chrono::milliseconds retryDelay(const string& what, bool transient, int attempt) {
+        RetryPolicy policy;
+        policy.maxRetries = max(0, currentConfig()->max_retries);
+        if (!transient || policy.maxRetries <= 0) return chrono::milliseconds(0);
+        if (attempt >= policy.maxRetries) {
+            retriesExhausted++;
+            logger.error("{}: still failing after {} {}", what, attempt, attempt == 1 ? "retry" : "retries");
+            return chrono::milliseconds(0);
+        }
+        chrono::milliseconds wait = max(policy.delay(attempt), chrono::milliseconds(1));
+        retriesScheduled++;
+        retryBackoffMs += wait.count();
+        logger.warn("{}: transient failure, retry {}/{} in {} ms", what, attempt + 1, policy.maxRetries, wait.count());
+        return wait;
+    }
+    
+    // applyToTarget with sleeping backoff, for callers that handle one
+    // target at a time on their own thread
+    ApplyOutcome applyWithRetry(const RegistryTarget& target, const string& locale, const PinnedLocale& info,
+                                bool confirm, PerformanceMonitor& perf) {
+        ApplyOutcome outcome = applyToTarget(target, locale, info, confirm, perf);
+        for (int attempt = 0; outcome.status == ApplyOutcome::Failed; attempt++) {
+            chrono::milliseconds wait = retryDelay(target.rootName, outcome.transient, attempt);
+            if (wait.count() == 0) break;
+            this_thread::sleep_for(wait);
+            perf.record("retry_backoff", wait);
+            outcome = applyToTarget(target, locale, info, false, perf);
+            if (outcome.status != ApplyOutcome::Failed) retriesRecovered++;
+        }
+        return outcome;
+    }
+    
+    // One target's apply, split into the stages a multi-profile run overlaps
+    // across profiles: capture (read and diff), backup (persist what will be
+    // overwritten) and write. A job is used by one stage at a time, and every
+    // stage reads the one Config it was created with.
+    struct ApplyJob {
+        shared_ptr<const Config> config;
+        RegistryTarget target;
+        string locale;
+        PinnedLocale info;                      // keeps its locale snapshot alive
+        PerformanceMonitor* perf;
+        shared_ptr<const RegistryBatch> full;   // the encoded batch, pinned across reloads
+        RegistryBatchView batch;                // borrows from full
+        RegistrySnapshot current;
+        bool haveCurrent = false;
+        ApplyOutcome outcome;
+        
+        ApplyJob(shared_ptr<const Config> config, const RegistryTarget& target, const string& locale, const PinnedLocale& info,
+                 PerformanceMonitor& perf, pmr::memory_resource* arena)
+            : config(move(config)), target(target), locale(locale), info(info), perf(&perf), batch(arena) {}
+    };
+    
+    // Read the live values once and reduce the batch to what differs. False
+    // when the target is already compliant and there is nothing to write.
+    bool captureStage(ApplyJob& job) {
+        job.full = encodedLocaleBatch(job.locale, job.info);
+        const RegistryBatch& full = *job.full;
+#ifdef _WIN32
+        const Config& config = *job.config;
+        if (config.skip_unchanged) {
+            {
+                auto timer = job.perf->phase("registry_read");
+                job.haveCurrent = NativeBackup::captureValues(job.target.root, kIntlKey, job.current);
+            }
+            if (job.haveCurrent) {
+                RegistryDiff::delta(full, job.current, job.batch);
+                if (job.batch.empty() &&
+                    (!hasExtendedSettings(config) || !extendedSettingsPending(config, job.target, job.locale))) {
+                    job.outcome.status = ApplyOutcome::Compliant;
+                    return false;
+                }
+                logger.info("{} value(s) differ from {} in {}", job.batch.size(), job.locale, job.target.rootName);
+            } else {
+                logger.warn("Could not read current values in {}, writing all settings", job.target.rootName);
+            }
+        }
+#endif
+        if (!job.haveCurrent) job.batch.addAll(full);
+        return true;
+    }
+    
+    // Persist the values the write will replace. The write stage only runs
+    // after this returns true, so nothing is committed without its backup.
+    bool backupStage(ApplyJob& job) {
+#ifdef _WIN32
+        const Config& config = *job.config;
+        if (job.batch.empty() || !config.backup_enabled) return true;
+        auto timer = job.perf->phase("backup");
+        bool saved;
+        if (job.haveCurrent) {
+            RegistrySnapshot overwritten = RegistryDiff::affected(job.current, job.batch);
+            saved = backupRegistry(config, job.target, kIntlKey, &overwritten);
+        } else {
+            saved = backupRegistry(config, job.target, kIntlKey);
+        }
+        if (!saved) {
+            logger.error("Backup failed in {}, leaving its values unchanged", job.target.rootName);
+            job.outcome.status = ApplyOutcome::Failed;
+        }
+        return saved;
+#else
+        (void)job;
+        return true;
+#endif
+    }
+    
+    void writeStage(ApplyJob& job) {
+        const Config& config = *job.config;
+#ifdef _WIN32
+        RegistryBatch::Result result;
+        if (!job.batch.empty()) {
+            {
+                auto timer = job.perf->phase("registry_writes");
+                result = job.batch.apply(logger, transactional(config, job.target), job.target.root);
+            }
+            logger.info("Registry operations: {}/{} successful", result.applied, job.batch.size());
+        }
+        job.outcome.changed = result.applied;
+        job.outcome.rolledBack = result.rolledBack;
+        if (result.failed > 0) {
+            job.outcome.status = ApplyOutcome::Failed;
+            job.outcome.transient = result.transient;
+            return;
+        }
+        
+        if (hasExtendedSettings(config)) {
+            auto timer = job.perf->phase("extended_settings");
+            job.outcome.changed += applyExtendedSettings(config, job.target, job.locale, job.outcome.complete);
+        }
+        job.outcome.status = job.outcome.changed > 0 ? ApplyOutcome::Applied : ApplyOutcome::Compliant;
+#else
+        logger.info("Non-Windows platform detected - running in demo mode");
+        cout << "\n[DEMO MODE] Would set the following registry values for " << job.locale << ":\n";
+        for (const auto& key : job.batch.entries()) {
+            for (const RegistryWrite* write : key.second) {
+                cout << "  " << write->valueName << " = " << RegistryBatch::describe(*write) << "\n";
+            }
+        }
+        {
+            auto timer = job.perf->phase("registry_writes");
+            job.batch.apply(logger, transactional(config, job.target), job.target.root);
+        }
+        job.outcome.changed = job.batch.size();
+        if (hasExtendedSettings(config)) {
+            auto timer = job.perf->phase("extended_settings");
+            job.outcome.changed += applyExtendedSettings(config, job.target, job.locale, job.outcome.complete);
+        }
+        job.outcome.status = ApplyOutcome::Applied;
+#endif
+    }
+    
+    // Diff, back up and write one locale into one hive, stage after stage on
+    // the calling thread. Everything it touches besides perf must be safe to
+    // use concurrently. Transient state lives in this thread's ApplyArena
+    // and is released in one step when the apply ends.
+    ApplyOutcome applyToTarget(const RegistryTarget& target, const string& locale, const PinnedLocale& info,
+                               bool confirm, PerformanceMonitor& perf) {
+        ApplyArena::Scope scratch("apply");
+        ApplyJob job(currentConfig(), target, locale, info, perf, scratch.resource());
+        if (!captureStage(job)) return job.outcome;
+        if (confirm && !confirmApply(info, perf)) {
+            job.outcome.status = ApplyOutcome::Cancelled;
+            return job.outcome;
+        }
+        if (backupStage(job)) writeStage(job);
+        return job.outcome;
+    }
+    
+#ifdef _WIN32
+    // Keys whose last-write times make up a loaded profile's stamp: every
+    // key the enabled settings read or write, present or not
+    static vector<string> stampedKeys(const Config& config) {
+        vector<string> keys = {kIntlKey};
+        if (config.feature("reset_windows11_memory")) {
+            keys.push_back("Control Panel\\International\\Geo");
+        }
+        if (config.feature("clear_user_profile_cache")) keys.push_back(kUserProfileKey);
+        if (config.feature("reset_office_settings")) {
+            for (const char* version : {"15.0", "16.0"}) {
+                for (const char* app : {"Word", "Excel", "PowerPoint", "Outlook"}) {
+                    string appKey = string("Software\\Microsoft\\Office\\") + version + "\\" + app;
+                    keys.push_back(appKey);
+                    keys.push_back(appKey + "\\Options");
+                }
+            }
+        }
+        if (config.feature("reset_mru_lists")) {
+            keys.insert(keys.end(), begin(kMruKeys), end(kMruKeys));
+        }
+        return keys;
+    }
+    
+    // Changes whenever anything an apply looks at changes. Offline hives are
+    // stamped by the NTUSER.DAT file time, which needs no mount. 0 = unknown.
+    uint64_t profileStamp(const Config& config, const UserProfile& profile) const {
+        if (!profile.loaded) return ProfileEnumerator::fileWriteTime(profile.hivePath);
+        RegistryKeyGuard root;
+        if (!root.openForRead(HKEY_USERS, profile.sid, KEY_READ)) return 0;
+        uint64_t stamp = fnv1a64(nullptr, 0);
+        for (const auto& key : stampedKeys(config)) {
+            uint64_t written = ProfileEnumerator::keyWriteTime(root.get(), key);
+            stamp = fnv1a64(reinterpret_cast<const uint8_t*>(&written), sizeof(written), stamp);
+        }
+        return stamp | 1;
+    }
+    
+    // What an apply of this locale writes, as one hash: the encoded values
+    // plus the extended-settings switches. A catalog or config change that
+    // alters any of it invalidates every indexed profile.
+    uint64_t applyFingerprint(const Config& config, const string& locale, const LocaleView& info) {
+        uint64_t hash = fnv1a64(reinterpret_cast<const uint8_t*>(locale.data()), locale.size());
+        auto mix = [&hash](const void* data, size_t size) { hash = fnv1a64(static_cast<const uint8_t*>(data), size, hash); };
+        for (const auto& key : encodedLocaleBatch(locale, info)->entries()) {
+            mix(key.first.data(), key.first.size());
+            for (const auto& write : key.second) {
+                vector<uint8_t> scratch;
+                const vector<uint8_t>* bytes = RegistryBatch::valueBytes(write, scratch);
+                mix(write.valueName.data(), write.valueName.size());
+                mix(&write.type, sizeof(write.type));
+                if (bytes != nullptr) mix(bytes->data(), bytes->size());
+            }
+        }
+        for (const char* feature : {"reset_windows11_memory", "reset_office_settings", "clear_user_profile_cache", "reset_mru_lists"}) {
+            uint8_t enabled = config.feature(feature) ? 1 : 0;
+            mix(&enabled, 1);
+        }
+        return hash;
+    }
+    
+#endif
+    
+    // A target on its way through the apply pipeline. Offline hives stay
+    // mounted from capture to write, so the queue depth also bounds how many
+    // are mounted at once.
+    struct PipelineJob {
+        string label;                   // for logs: "Profile <sid>", "Manifest line <n>"
+        RegistryTarget target;          // used as-is unless mount is set
+        bool mount = false;
+#ifdef _WIN32
+        UserProfile profile;
+        unique_ptr<ProfileHive> hive;
+#endif
+        string locale;
+        PinnedLocale info;
+        size_t slot = 0;                // the caller's result index
+        int attempt = 0;
+        bool indexed = false;           // consult and update the profile index
+        bool fromIndex = false;         // skipped as unchanged by it
+        uint64_t fingerprint = 0;
+        string error;
+        chrono::microseconds elapsed{0};    // summed over attempts, backoff excluded
+        chrono::steady_clock::time_point started;
+        PerformanceMonitor perf;
+        JobArena arena{"pipeline"};     // the job's transient state, freed with it
+        unique_ptr<ApplyJob> apply;
+        ApplyOutcome outcome;
+        
+        unique_ptr<PipelineJob> retry() const {
+            unique_ptr<PipelineJob> next(new PipelineJob());
+            next->label = label;
+            next->target = target;
+            next->mount = mount;
+#ifdef _WIN32
+            next->profile = profile;
+#endif
+            next->locale = locale;
+            next->info = info;
+            next->slot = slot;
+            next->attempt = attempt + 1;
+            next->indexed = indexed;
+            next->fingerprint = fingerprint;
+            next->elapsed = elapsed;
+            return next;
+        }
+    };
+    
+    // Runs one pipeline step, turning an exception into a failed job
+    bool guardedStep(PipelineJob& job, const function<bool()>& step) {
+        try {
+            return step();
+        } catch (const exception& e) {
+            job.error = e.what();
+            logger.error("{} failed: {}", job.label, e.what());
+            if (job.apply) job.apply->outcome.status = ApplyOutcome::Failed;
+            return false;
+        }
+    }
+    
+    bool captureJob(PipelineJob& job, const shared_ptr<const Config>& config) {
+        job.started = chrono::steady_clock::now();
+        job.perf.start();
+#ifdef _WIN32
+        if (job.indexed && profileIndex.compliant(job.profile.sid, profileStamp(*config, job.profile), job.fingerprint)) {
+            job.fromIndex = true;
+            job.outcome.status = ApplyOutcome::Compliant;
+            return false;
+        }
+        if (job.mount) {
+            job.hive.reset(new ProfileHive());
+            LONG status = job.hive->open(job.profile);
+            if (status != ERROR_SUCCESS) {
+                job.error = "cannot open hive (Error: " + to_string(status) + ")";
+                logger.error("{}: {}", job.label, job.error);
+                job.outcome.transient = RetryPolicy::isTransient(status);
+                return false;
+            }
+            job.target = job.hive->target(job.profile);
+        }
+#endif
+        job.apply.reset(new ApplyJob(config, job.target, job.locale, job.info, job.perf, &job.arena));
+        return captureStage(*job.apply);
+    }
+    
+    // Multi-target apply as three overlapped stages: capture (hive mount,
+    // read, diff) and write run on `workers` threads each, backup on one,
+    // since the store serializes commits anyway. While job N writes, N+1 is
+    // being backed up and N+2 captured. Each job is backed up before it is
+    // written. Transient failures are parked and run again in a later pass
+    // after their backoff; done() sees every job's final outcome. Every job,
+    // retries included, applies the config the run was started with.
+    void runApplyPipeline(vector<unique_ptr<PipelineJob>> jobs, size_t workers, const shared_ptr<const Config>& config,
+                          PerformanceMonitor& perf, const function<void(PipelineJob&)>& done) {
+        mutex parkedMutex;
+        vector<unique_ptr<PipelineJob>> parked;
+        chrono::milliseconds parkedWait(0);
+        auto finish = [&](PipelineJob& job) {
+            if (job.apply) {
+                job.outcome = job.apply->outcome;
+                job.apply.reset();
+            }
+#ifdef _WIN32
+            job.hive.reset();       // unmount before anything stamps the hive file
+#endif
+            if (job.started != chrono::steady_clock::time_point()) {
+                job.elapsed += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - job.started);
+            }
+            if (job.outcome.status == ApplyOutcome::Failed) {
+                chrono::milliseconds wait = retryDelay(job.label, job.outcome.transient, job.attempt);
+                if (wait.count() > 0) {
+                    lock_guard<mutex> lock(parkedMutex);
+                    parkedWait = max(parkedWait, wait);
+                    parked.push_back(job.retry());
+                    return;
+                }
+            } else if (job.attempt > 0) {
+                retriesRecovered++;
+            }
+            done(job);
+        };
+        
+        while (!jobs.empty()) {
+            StagePipeline<PipelineJob> pipeline(workers);
+            pipeline.stage("capture", workers, [this, &config](PipelineJob& job) {
+                return guardedStep(job, [&] { return captureJob(job, config); });
+            });
+            pipeline.stage("backup", 1, [this](PipelineJob& job) {
+                return guardedStep(job, [&] { return backupStage(*job.apply); });
+            });
+            pipeline.stage("write", workers, [this](PipelineJob& job) {
+                return guardedStep(job, [&] {
+                    writeStage(*job.apply);
+                    return true;
+                });
+            });
+            pipeline.run(move(jobs), finish);
+            
+            const StagePipeline<PipelineJob>::StageStats* slowest = nullptr;
+            vector<StagePipeline<PipelineJob>::StageStats> stages = pipeline.stats();
+            for (const auto& stage : stages) {
+                perf.record("stage_" + stage.name, stage.busy);
+                logger.debug("Pipeline stage {}: {} job(s), {} ms busy on {} thread(s)", stage.name, stage.jobs,
+                             stage.busy.count() / 1000, stage.threads);
+                if (slowest == nullptr || stage.busy.count() / stage.threads > slowest->busy.count() / slowest->threads) {
+                    slowest = &stage;
+                }
+            }
+            if (slowest != nullptr && slowest->jobs > 0) {
+                logger.info("Pipeline bottleneck: {} stage ({} ms per thread)", slowest->name,
+                            slowest->busy.count() / 1000 / static_cast<long long>(slowest->threads));
+            }
+            
+            jobs = move(parked);
+            parked.clear();
+            if (!jobs.empty()) {
+                this_thread::sleep_for(parkedWait);
+                perf.record("retry_backoff", parkedWait);
+                parkedWait = chrono::milliseconds(0);
+            }
+        }
+    }
+    
+    // One line of a --manifest file: <target> [locale]
+    struct ManifestJob {
+        size_t line = 0;
+        string target;
+        string locale;
+        bool currentUser = false;
+#ifdef _WIN32
+        UserProfile profile;
+#endif
+    };
+    
+    struct ManifestResult {
+        string status = "failed";   // applied, compliant, skipped or failed
+        size_t changed = 0;
+        long long durationUs = 0;   // time in the pipeline, summed over attempts
+        int retries = 0;
+        string error;
+    };
+    
+    // Split a manifest line into whitespace separated fields; double quotes
+    // keep hive paths with spaces together
+    static vector<string> manifestFields(const string& line) {
+        vector<string> fields;
+        size_t i = 0;
+        while (i < line.size()) {
+            while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) i++;
+            if (i >= line.size() || line[i] == '#') break;
+            string field;
+            if (line[i] == '"') {
+                size_t end = line.find('"', i + 1);
+                if (end == string::npos) end = line.size();
+                field = line.substr(i + 1, end - i - 1);
+                i = end + 1;
+            } else {
+                size_t end = i;
+                while (end < line.size() && !isspace(static_cast<unsigned char>(line[end]))) end++;
+                field = line.substr(i, end - i);
+                i = end;
+            }
+            fields.push_back(field);
+        }
+        return fields;
+    }
+    
+    // Record a manifest job's final outcome; called from pipeline threads
+    void finishManifestJob(const ManifestJob& job, ManifestResult& result, const PipelineJob& run) {
+        const ApplyOutcome& outcome = run.outcome;
+        result.changed = outcome.changed;
+        result.durationUs = run.elapsed.count();
+        result.retries = run.attempt;
+        result.error = run.error;
+        if (outcome.status != ApplyOutcome::Failed && !outcome.complete && result.error.empty()) {
+            result.error = "extended settings partially applied";
+        }
+        if (outcome.status == ApplyOutcome::Applied) {
+            result.status = "applied";
+            successCount++;
+            profilesUpdated++;
+        } else if (outcome.status == ApplyOutcome::Compliant) {
+            result.status = "compliant";
+            successCount++;
+            profilesCompliant++;
+        } else {
+            if (result.error.empty()) {
+                result.error = outcome.rolledBack ? "registry write failed, rolled back" : "registry write failed";
+            }
+            logger.error("Manifest line {} ({}): {}", job.line, job.target, result.error);
+            errorCount++;
+            profilesFailed++;
+            lock_guard<mutex> lock(profileResultsMutex);
+            failedProfiles.push_back(job.target);
+        }
+    }
+    
+    // Post-commit stage: one WM_SETTINGCHANGE for every write of the run
+    bool notifySettingChange(PerformanceMonitor& perf) {
+        shared_ptr<const Config> config = currentConfig();
+        SettingChangeBroadcast::Result result;
+        {
+            auto timer = perf.phase("broadcast");
+            result = SettingChangeBroadcast::send(chrono::milliseconds(config->broadcast_timeout_ms));
+        }
+        switch (result) {
+            case SettingChangeBroadcast::Delivered:
+#ifdef _WIN32
+                logger.info("Broadcast WM_SETTINGCHANGE (intl) to running applications");
+#else
+                cout << "[DEMO MODE] Would broadcast WM_SETTINGCHANGE (intl)\n";
+#endif
+                return true;
+            case SettingChangeBroadcast::TimedOut:
+                logger.warn("WM_SETTINGCHANGE broadcast still pending after {} ms, continuing; a hung application may need a restart",
+                            config->broadcast_timeout_ms);
+                return false;
+            case SettingChangeBroadcast::Failed:
+                logger.warn("WM_SETTINGCHANGE broadcast failed");
+                return false;
+            case SettingChangeBroadcast::Disabled:
+                break;
+        }
+        return false;
+    }
+    
+#ifdef _WIN32
+    // One --watch pass: diff the live values read through the watched handle
+    // and write back only those that drifted. Returns true if it corrected.
+    bool correctDrift(HKEY watched, const string& locale, const RegistryBatch& target) {
+        shared_ptr<const Config> config = currentConfig();
+        PerformanceMonitor perf = startOperation();
+        RegistrySnapshot current;
+        {
+            auto timer = perf.phase("registry_read");
+            if (!NativeBackup::captureOpenValues(watched, kIntlKey, current)) {
+                logger.warn("Could not read HKEY_CURRENT_USER\\{}", kIntlKey);
+                return false;
+            }
+        }
+        RegistryBatch drift = RegistryDiff::delta(target, current);
+        if (drift.empty()) return false;
+        
+        operationCount++;
+        logger.info("Drift detected: {} value(s) differ from {}", drift.size(), locale);
+        RegistryTarget user = RegistryTarget::currentUser();
+        if (config->backup_enabled) {
+            auto timer = perf.phase("backup");
+            RegistrySnapshot overwritten = RegistryDiff::affected(current, drift);
+            if (!backupRegistry(*config, user, kIntlKey, &overwritten)) {
+                logger.error("Backup failed, drift not corrected");
+                errorCount++;
+                return false;
+            }
+        }
+        RegistryBatch::Result result;
+        {
+            auto timer = perf.phase("registry_writes");
+            result = drift.apply(logger, config->transactional_writes, user.root);
+        }
+        if (result.failed == 0) {
+            successCount++;
+            notifySettingChange(perf);
+        } else {
+            errorCount++;
+            logger.error("Drift correction failed{}", result.rolledBack ? ", changes rolled back" : "");
+        }
+        perf.stop(logger, "watch " + locale);
+        exportMetrics();
+        return result.failed == 0;
+    }
+#endif
+    
+    bool confirmApply(const LocaleView& info, PerformanceMonitor& perf) {
+        cout << "\nThis will change all regional settings to: " << info.name << "\n";
+        cout << "Continue? (y/N): ";
+        string confirm;
+        perf.pause();
+        getline(cin, confirm);
+        perf.resume();
+        if (confirm != "y" && confirm != "Y") {
+            logger.info("Operation cancelled by user");
+            return false;
+        }
+        return true;
+    }
+    
+public:
+    static constexpr const char* kIntlKey = "Control Panel\\International";
+    
+    // The ten International values that make up a locale
+    static RegistryBatch localeBatch(const string& locale, const LocaleView& info) {
+        RegistryBatch batch;
+        batch.set(kIntlKey, "LocaleName", locale);
+        batch.set(kIntlKey, "sCountry", info.country);
+        batch.set(kIntlKey, "sShortDate", info.shortDate);
+        batch.set(kIntlKey, "sLongDate", info.longDate);
+        batch.set(kIntlKey, "sTimeFormat", info.timeFormat);
+        batch.set(kIntlKey, "sCurrency", info.currency);
+        batch.set(kIntlKey, "sDecimal", info.decimalSep);
+        batch.set(kIntlKey, "sThousand", info.thousandSep);
+        batch.set(kIntlKey, "sList", info.listSep);
+        batch.set(kIntlKey, "iCountry", to_string(info.countryCode), REG_DWORD);
+        batch.encode();
+        return batch;
+    }
+    
+    // Headless runs print no banner; locale sources are loaded lazily in every
+    // mode. launched is when main started, so the startup breakdown covers
+    // argument parsing and member construction as well
+    explicit RegionalSettingsManager(bool headlessMode = false,
+                                     chrono::steady_clock::time_point launched = chrono::steady_clock::now())
+        : logger("", true), operationCount(0), successCount(0), errorCount(0),
+          resolver([this](const string& tag, PinnedLocale& out) { ensureLocales(); return findLocale(tag, out); },
+                   [this] { ensureLocales(); return allLocales(); },
+                   [this](const string& tag, PinnedLocale& out) { ensureLocales(); return systemLocales.find(tag, out); }),
+          headless(headlessMode), launchTime(launched) {
+        markStartup("init", launched);
+        auto configStart = chrono::steady_clock::now();
+        loadConfig();
+        markStartup("config", configStart);
+        // The store directory is only created once something is backed up
+        shared_ptr<const Config> config = currentConfig();
+        backupStore.setPath(config->backup_path.empty() ? "backups" : config->backup_path);
+    }
+    
+    ~RegionalSettingsManager() {
+        exportMetrics();
+    }
+    
+    // Counters plus the phase/value histograms, for a Prometheus textfile collector
+    void exportMetrics() {
+        shared_ptr<const Config> config = currentConfig();
+        if (config->metrics_path.empty()) return;
+        vector<MetricsRegistry::Sample> counters = {
+            {"regreset_operations_total", "Operations started", static_cast<uint64_t>(operationCount.load())},
+            {"regreset_operations_succeeded_total", "Operations that succeeded", static_cast<uint64_t>(successCount.load())},
+            {"regreset_operations_failed_total", "Operations that failed", static_cast<uint64_t>(errorCount.load())},
+            {"regreset_profiles_updated_total", "Profiles whose settings were changed", static_cast<uint64_t>(profilesUpdated.load())},
+            {"regreset_profiles_compliant_total", "Profiles already compliant", static_cast<uint64_t>(profilesCompliant.load())},
+            {"regreset_profiles_failed_total", "Profiles that failed", static_cast<uint64_t>(profilesFailed.load())},
+            {"regreset_retries_total", "Retries scheduled after transient failures", static_cast<uint64_t>(retriesScheduled.load())},
+            {"regreset_retries_recovered_total", "Operations that succeeded on a retry", static_cast<uint64_t>(retriesRecovered.load())},
+            {"regreset_retries_exhausted_total", "Operations still failing after max_retries", static_cast<uint64_t>(retriesExhausted.load())},
+            {"regreset_retry_backoff_ms_total", "Latency added by retry backoff", static_cast<uint64_t>(retryBackoffMs.load())}
+        };
+        if (!MetricsRegistry::instance().writePrometheusFile(config->metrics_path, counters)) {
+            logger.warn("Failed to write metrics: {}", config->metrics_path);
+        }
+    }
+    
+    string defaultLocale() const { return currentConfig()->default_locale; }
+    
+    void printBanner() {
+        cout << "\n================================================\n";
+        cout << " Windows Regional Settings Reset - C++ Edition\n";
+        cout << "                    v2.1\n";
+        cout << "================================================\n";
+        logger.info("Regional Settings Manager started");
+    }
+    
+    void listLocales() {
+        shared_ptr<const Config> config = currentConfig();
+        ensureLocales();
+        cout << "\nSupported Locales:\n";
+        cout << "==================\n";
+        for (const auto& entry : allLocales()) {
+            cout << "  " << entry.tag << " - " << entry.name << "\n";
+        }
+        if (systemLocales.isCached()) {
+            cout << "  (plus " << systemLocales.cachedCount() << " OS locales from " << config->system_locale_cache << ")\n";
+        }
+        cout << "\n";
+    }
+    
+    bool applyLocale(const string& requested, bool force = false) {
+        operationCount++;
+        PerformanceMonitor perf = startOperation();
+        
+        string locale;
+        PinnedLocale info;
+        bool resolved = resolveLocale(requested, locale, info);
+        reportStartup(perf);
+        if (!resolved) {
+            reportUnsupported(requested);
+            errorCount++;
+            return false;
+        }
+        
+        logger.info("Applying settings for locale: {} ({})", locale, info.name);
+        
+#ifdef _WIN32
+        logger.info("Windows detected - using registry API");
+#endif
+        
+        ApplyOutcome outcome = applyWithRetry(RegistryTarget::currentUser(), locale, info, !force, perf);
+        switch (outcome.status) {
+            case ApplyOutcome::Compliant:
+                successCount++;
+                logger.info("Already compliant: {}, no registry changes needed", locale);
+                cout << "\n[SUCCESS] Regional settings already match " << locale << "\n";
+                perf.stop(logger, locale);
+                return true;
+            case ApplyOutcome::Cancelled:
+                return false;
+            case ApplyOutcome::Applied:
+                successCount++;
+#ifdef _WIN32
+                logger.info("Successfully configured {}", locale);
+                cout << "\n[SUCCESS] Regional settings updated for " << locale << "\n";
+                if (notifySettingChange(perf)) {
+                    cout << "Running applications were notified of the change.\n";
+                } else {
+                    cout << "Note: Sign out and back in for all applications to pick up the change.\n";
+                }
+#else
+                notifySettingChange(perf);
+                cout << "\n[SUCCESS] Demo mode completed for " << locale << "\n";
+                logger.info("Demo mode completed successfully for {}", locale);
+#endif
+                perf.stop(logger, locale);
+                return true;
+            case ApplyOutcome::Failed:
+                break;
+        }
+        
+        errorCount++;
+        if (outcome.rolledBack) {
+            logger.error("Failed configuring {}, changes rolled back", locale);
+        } else {
+            logger.error("Partial failure configuring {}", locale);
+        }
+        return false;
+    }
+    
+    // Apply one locale to every user profile on the machine in parallel
+    bool applyAllProfiles(const string& requested, bool force = false) {
+        shared_ptr<const Config> config = currentConfig();
+        string locale;
+        PinnedLocale info;
+        if (!resolveLocale(requested, locale, info)) {
+            reportUnsupported(requested);
+            errorCount++;
+            return false;
+        }
+        
+#ifdef _WIN32
+        if (!config->profile_index_path.empty() && !profileIndex.isOpen()) {
+            if (profileIndex.open(config->profile_index_path)) {
+                logger.info("Profile index {}: {} profile(s)", config->profile_index_path, profileIndex.size());
+            }
+        }
+        vector<UserProfile> profiles = ProfileEnumerator::enumerate(config->include_offline_profiles,
+                                                                    profileIndex.isOpen() ? &profileIndex : nullptr);
+        bool needsMount = any_of(profiles.begin(), profiles.end(), [](const UserProfile& p) { return !p.loaded; });
+        if (needsMount && !(ProfileEnumerator::enablePrivilege(SE_BACKUP_NAME) && ProfileEnumerator::enablePrivilege(SE_RESTORE_NAME))) {
+            logger.warn("Backup/restore privileges unavailable, offline profiles will be skipped");
+            profiles.erase(remove_if(profiles.begin(), profiles.end(), [](const UserProfile& p) { return !p.loaded; }), profiles.end());
+        }
+        if (profiles.empty()) {
+            logger.warn("No user profiles found");
+            return false;
+        }
+        
+        if (!force) {
+            cout << "\nThis will change regional settings for " << profiles.size() << " profile(s) to: " << info.name << "\n";
+            cout << "Continue? (y/N): ";
+            string confirm;
+            getline(cin, confirm);
+            if (confirm != "y" && confirm != "Y") {
+                logger.info("Operation cancelled by user");
+                return false;
+            }
+        }
+        
+        size_t workers = config->max_parallel_profiles > 0 ? static_cast<size_t>(config->max_parallel_profiles)
+                                                          : max(1u, thread::hardware_concurrency());
+        workers = min(workers, profiles.size());
+        logger.info("Applying {} to {} profile(s) on {} worker(s)", locale, profiles.size(), workers);
+        
+        PerformanceMonitor perf = startOperation();
+        reportStartup(perf);
+        auto started = chrono::steady_clock::now();
+        // The counters live as long as the manager; this run is the difference
+        const int updatedBefore = profilesUpdated.load();
+        const int compliantBefore = profilesCompliant.load();
+        const int indexedBefore = profilesIndexed.load();
+        const int failedBefore = profilesFailed.load();
+        bool indexed = config->skip_unchanged && profileIndex.isOpen();
+        uint64_t fingerprint = indexed ? applyFingerprint(*config, locale, info) : 0;
+        vector<unique_ptr<PipelineJob>> jobs;
+        for (const auto& profile : profiles) {
+            operationCount++;
+            unique_ptr<PipelineJob> job(new PipelineJob());
+            job->label = "Profile " + profile.sid;
+            job->mount = true;
+            job->profile = profile;
+            job->locale = locale;
+            job->info = info;
+            job->indexed = indexed;
+            job->fingerprint = fingerprint;
+            jobs.push_back(move(job));
+        }
+        runApplyPipeline(move(jobs), workers, config, perf, [this, &config](PipelineJob& job) {
+            const UserProfile& profile = job.profile;
+            if (job.fromIndex) {
+                successCount++;
+                profilesCompliant++;
+                profilesIndexed++;
+                logger.info("Profile {}: unchanged since last compliant apply", profile.sid);
+                return;
+            }
+            // The hive is released by now, so the stamp includes our own writes
+            // Only a full success is indexed, or a failed subsystem is never retried
+            if (job.indexed && job.outcome.status != ApplyOutcome::Failed && job.outcome.complete) {
+                profileIndex.markCompliant(profile.sid, profileStamp(*config, profile), job.fingerprint);
+            } else if (job.indexed) {
+                profileIndex.invalidate(profile.sid);
+            }
+            if (job.outcome.status != ApplyOutcome::Failed && !job.outcome.complete) {
+                logger.warn("Profile {}: extended settings incomplete, will be applied again next run", profile.sid);
+            }
+            
+            if (job.outcome.status == ApplyOutcome::Applied) {
+                successCount++;
+                profilesUpdated++;
+                logger.info("Profile {}: {} value(s) updated", profile.sid, job.outcome.changed);
+            } else if (job.outcome.status == ApplyOutcome::Compliant) {
+                successCount++;
+                profilesCompliant++;
+                logger.info("Profile {}: already compliant", profile.sid);
+            } else {
+                errorCount++;
+                profilesFailed++;
+                lock_guard<mutex> lock(profileResultsMutex);
+                failedProfiles.push_back(profile.sid);
+            }
+        });
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+        logger.info("Multi-profile apply finished in {} ms: {} updated, {} already compliant ({} from the index), {} failed",
+                    elapsed.count(), profilesUpdated.load() - updatedBefore, profilesCompliant.load() - compliantBefore,
+                    profilesIndexed.load() - indexedBefore, profilesFailed.load() - failedBefore);
+        if (profileIndex.isOpen() && !profileIndex.save()) {
+            logger.warn("Cannot write profile index: {}", config->profile_index_path);
+        }
+        if (profilesUpdated.load() > updatedBefore) {
+            notifySettingChange(perf);
+        }
+        perf.stop(logger, locale + " (all profiles)");
+        return profilesFailed.load() == failedBefore;
+#else
+        (void)force;
+        logger.info("Non-Windows platform detected - running in demo mode");
+        cout << "\n[DEMO MODE] Would apply " << locale << " (" << info.name << ") to every loaded and offline user profile\n";
+        return true;
+#endif
+    }
+    
+    // Apply every (target, locale) line of a manifest without prompting.
+    // Lines are streamed into the pool as they are read; the report holds
+    // one JSON object per line in manifest order.
+    bool applyManifest(const string& manifestPath, int jobs, const string& reportPath) {
+        shared_ptr<const Config> config = currentConfig();
+        ifstream manifest(manifestPath);
+        if (!manifest.is_open()) {
+            logger.error("Cannot open manifest: {}", manifestPath);
+            errorCount++;
+            return false;
+        }
+        
+        size_t workers = jobs > 0 ? static_cast<size_t>(jobs)
+                       : config->max_parallel_profiles > 0 ? static_cast<size_t>(config->max_parallel_profiles)
+                       : max(1u, thread::hardware_concurrency());
+        logger.info("Running manifest {} on {} worker(s)", manifestPath, workers);
+        
+#ifdef _WIN32
+        vector<UserProfile> knownProfiles;
+        bool profilesEnumerated = false;
+        bool privilegesTried = false;
+        bool privilegesHeld = false;
+#endif
+        // deque keeps element addresses stable while the pipeline fills them in
+        deque<ManifestJob> jobList;
+        deque<ManifestResult> results;
+        // First line naming each hive; a second concurrent writer would race
+        // its snapshot and backup against the first
+        map<string, pair<size_t, string>> hiveLines;    // hive -> (line, resolved locale)
+        string currentHive;
+        // Lines rejected while parsing never reach a worker
+        auto reject = [this](const ManifestJob& job, ManifestResult& result, const string& error) {
+            result.error = error;
+            operationCount++;
+            errorCount++;
+            profilesFailed++;
+            logger.error("Manifest line {} ({}): {}", job.line, job.target, error);
+            lock_guard<mutex> lock(profileResultsMutex);
+            failedProfiles.push_back(job.target);
+        };
+        PerformanceMonitor perf = startOperation();
+        ensureLocales();
+        reportStartup(perf);
+        auto started = chrono::steady_clock::now();
+        {
+            vector<unique_ptr<PipelineJob>> runs;
+            string line;
+            size_t lineNumber = 0;
+            while (getline(manifest, line)) {
+                lineNumber++;
+                vector<string> fields = manifestFields(line);
+                if (fields.empty()) continue;
+                
+                jobList.emplace_back();
+                results.emplace_back();
+                ManifestJob& job = jobList.back();
+                ManifestResult& result = results.back();
+                job.line = lineNumber;
+                job.target = fields[0];
+                job.locale = fields.size() > 1 ? fields[1] : config->default_locale;
+                if (fields.size() > 2) {
+                    reject(job, result, "too many fields");
+                    continue;
+                }
+                
+                string lowered = job.target;
+                transform(lowered.begin(), lowered.end(), lowered.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+                bool isSid = lowered.compare(0, 4, "s-1-") == 0;
+                bool isHive = !isSid && (job.target.find_first_of("\\/") != string::npos ||
+                                         (lowered.size() > 4 && lowered.compare(lowered.size() - 4, 4, ".dat") == 0));
+                if (lowered == "current" || lowered == "hkcu") {
+                    job.currentUser = true;
+                } else if (!isSid && !isHive) {
+                    reject(job, result, "unknown target");
+                    continue;
+                }
+                
+                // Key lines by the hive they resolve to: current and hkcu are the
+                // caller's SID, SIDs compare upper case, paths compare canonical
+                string hiveKey;
+                string hivePath;
+                if (job.currentUser) {
+                    if (currentHive.empty()) {
+#ifdef _WIN32
+                        currentHive = ProfileEnumerator::currentUserSid();
+#endif
+                        if (currentHive.empty()) currentHive = "current";
+                    }
+                    hiveKey = currentHive;
+                } else if (isSid) {
+                    hiveKey = job.target;
+                    transform(hiveKey.begin(), hiveKey.end(), hiveKey.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+                } else {
+                    error_code ec;
+                    fs::path canonical = fs::weakly_canonical(fs::path(job.target), ec);
+                    hivePath = ec ? job.target : canonical.string();
+                    hiveKey = hivePath;
+                    transform(hiveKey.begin(), hiveKey.end(), hiveKey.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+                }
+#ifdef _WIN32
+                if (!job.currentUser) {
+                    if (!profilesEnumerated) {
+                        knownProfiles = ProfileEnumerator::enumerate(true);
+                        profilesEnumerated = true;
+                    }
+                    auto found = find_if(knownProfiles.begin(), knownProfiles.end(), [&](const UserProfile& p) {
+                        string known;
+                        if (isSid) {
+                            known = p.sid;
+                            transform(known.begin(), known.end(), known.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+                        } else if (!p.hivePath.empty()) {
+                            error_code ec;
+                            known = fs::weakly_canonical(fs::path(p.hivePath), ec).string();
+                            if (ec) known = p.hivePath;
+                            transform(known.begin(), known.end(), known.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+                        }
+                        return !known.empty() && known == hiveKey;
+                    });
+                    if (found != knownProfiles.end()) {
+                        // A path that belongs to a profile is that profile's hive
+                        job.profile = *found;
+                        hiveKey = found->sid;
+                        transform(hiveKey.begin(), hiveKey.end(), hiveKey.begin(), [](unsigned char c) { return static_cast<char>(toupper(c)); });
+                    } else if (isSid) {
+                        reject(job, result, "profile not found");
+                        continue;
+                    } else {
+                        job.profile = UserProfile::forHive(hivePath);
+                    }
+                }
+#endif
+                LocaleResolver::Resolution resolved = resolver.resolve(job.locale);
+                if (!resolved.found) {
+                    reject(job, result, "unsupported locale");
+                    continue;
+                }
+                auto first = hiveLines.emplace(hiveKey, make_pair(job.line, resolved.tag));
+                if (!first.second) {
+                    size_t earlier = first.first->second.first;
+                    if (first.first->second.second != resolved.tag) {
+                        reject(job, result, "conflicts with line " + to_string(earlier) + " (same hive)");
+                        continue;
+                    }
+                    result.status = "skipped";
+                    result.error = "same hive as line " + to_string(earlier);
+                    logger.warn("Manifest line {} ({}): {}", job.line, job.target, result.error);
+                    continue;
+                }
+#ifdef _WIN32
+                if (!job.currentUser && !job.profile.loaded) {
+                    if (!privilegesTried) {
+                        privilegesHeld = ProfileEnumerator::enablePrivilege(SE_BACKUP_NAME) && ProfileEnumerator::enablePrivilege(SE_RESTORE_NAME);
+                        privilegesTried = true;
+                    }
+                    if (!privilegesHeld) {
+                        reject(job, result, "backup/restore privileges unavailable");
+                        continue;
+                    }
+                }
+#endif
+                
+                operationCount++;
+                unique_ptr<PipelineJob> run(new PipelineJob());
+                run->label = "Manifest line " + to_string(job.line);
+                run->slot = jobList.size() - 1;
+                run->locale = resolved.tag;
+                run->info = resolved.view;
+                if (job.currentUser) {
+                    run->target = RegistryTarget::currentUser();
+                } else {
+#ifdef _WIN32
+                    run->mount = true;
+                    run->profile = job.profile;
+#else
+                    run->target = {HKEY_USERS, "HKEY_USERS\\" + job.target, job.target};
+#endif
+                }
+                runs.push_back(move(run));
+            }
+            runApplyPipeline(move(runs), workers, config, perf, [this, &jobList, &results](PipelineJob& run) {
+                finishManifestJob(jobList[run.slot], results[run.slot], run);
+            });
+        }
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+        
+        size_t failed = count_if(results.begin(), results.end(), [](const ManifestResult& r) { return r.status == "failed"; });
+        if (any_of(results.begin(), results.end(), [](const ManifestResult& r) { return r.status == "applied"; })) {
+            notifySettingChange(perf);
+        }
+        
+        string report = reportPath.empty() ? manifestPath + ".report.jsonl" : reportPath;
+        ofstream out(report, ios::trunc);
+        if (out.is_open()) {
+            for (size_t i = 0; i < results.size(); i++) {
+                out << "{\"line\":" << jobList[i].line
+                    << ",\"target\":\"" << jsonEscape(jobList[i].target) << "\""
+                    << ",\"locale\":\"" << jsonEscape(jobList[i].locale) << "\""
+                    << ",\"status\":\"" << results[i].status << "\""
+                    << ",\"changed\":" << results[i].changed
+                    << ",\"duration_us\":" << results[i].durationUs
+                    << ",\"retries\":" << results[i].retries
+                    << ",\"error\":\"" << jsonEscape(results[i].error) << "\"}\n";
+            }
+            logger.info("Manifest report written to {}", report);
+        } else {
+            logger.warn("Cannot write manifest report: {}", report);
+        }
+        
+        logger.info("Manifest finished in {} ms: {} job(s), {} failed", elapsed.count(), results.size(), failed);
+        perf.stop(logger, "manifest " + manifestPath);
+        return failed == 0;
+    }
+    
+    // One line of a --fleet hosts file: <host> [locale]
+    struct FleetHost {
+        size_t line = 0;
+        string host;
+        string locale;
+    };
+    
+    struct FleetResult {
+        string status = "failed";   // applied, compliant, skipped or failed
+        string locale;              // as resolved
+        size_t profiles = 0;
+        size_t profilesFailed = 0;
+        size_t changed = 0;
+        long long durationUs = 0;
+        string error;
+    };
+    
+    // Worker body for applyFleet: one connection, then every loaded profile
+    // on that host in turn through the same handle. Once abandoned is set
+    // (the host deadline passed) no further profile is started.
+    void runFleetHost(const FleetHost& job, FleetResult& result, const atomic<bool>& abandoned) {
+        shared_ptr<const Config> config = currentConfig();
+        operationCount++;
+        auto started = chrono::steady_clock::now();
+        PerformanceMonitor perf;
+        perf.start();
+        
+        LocaleResolver::Resolution resolved = resolver.resolve(job.locale);
+        result.locale = resolved.found ? resolved.tag : job.locale;
+        if (!resolved.found) {
+            result.error = "unsupported locale";
+        } else {
+#ifdef _WIN32
+            RemoteRegistry remote;
+            LONG status;
+            {
+                auto timer = perf.phase("remote_connect");
+                status = remote.connect(job.host, chrono::milliseconds(config->remote_connect_timeout_ms));
+            }
+            if (status != ERROR_SUCCESS) {
+                result.error = status == ERROR_TIMEOUT ? "connect timed out" : "connect failed (Error: " + to_string(status) + ")";
+            } else {
+                vector<string> sids = remote.loadedUsers();
+                result.profiles = sids.size();
+                for (const auto& sid : sids) {
+                    if (abandoned) break;
+                    HKEY root = NULL;
+                    u16string wideSid = utf8ToUtf16(sid);
+                    ApplyOutcome outcome;
+                    if (RegOpenKeyExW(remote.get(), reinterpret_cast<LPCWSTR>(wideSid.c_str()), 0, KEY_READ | KEY_WRITE, &root) == ERROR_SUCCESS) {
+                        RegistryTarget target{root, "\\\\" + job.host + "\\HKEY_USERS\\" + sid, job.host + "\\" + sid, true};
+                        try {
+                            outcome = applyWithRetry(target, result.locale, resolved.view, false, perf);
+                        } catch (const exception& e) {
+                            logger.error("Host {} profile {} failed: {}", job.host, sid, e.what());
+                        }
+                        RegCloseKey(root);
+                    } else {
+                        logger.error("Host {}: cannot open profile {}", job.host, sid);
+                    }
+                    
+                    result.changed += outcome.changed;
+                    if (outcome.status == ApplyOutcome::Applied) {
+                        profilesUpdated++;
+                    } else if (outcome.status == ApplyOutcome::Compliant) {
+                        profilesCompliant++;
+                    } else {
+                        profilesFailed++;
+                        result.profilesFailed++;
+                        lock_guard<mutex> lock(profileResultsMutex);
+                        failedProfiles.push_back(job.host + "\\" + sid);
+                    }
+                }
+                if (sids.empty()) {
+                    result.status = "skipped";
+                    result.error = "no loaded user profiles";
+                } else if (result.profilesFailed > 0) {
+                    result.error = to_string(result.profilesFailed) + " of " + to_string(sids.size()) + " profile(s) failed";
+                } else {
+                    result.status = result.changed > 0 ? "applied" : "compliant";
+                }
+            }
+#else
+            (void)abandoned;
+            cout << "\n[DEMO MODE] Would connect to \\\\" << job.host << " and apply " << result.locale
+                 << " to every loaded profile\n";
+            result.status = "skipped";
+            result.error = "demo mode";
+#endif
+        }
+        
+        result.durationUs = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+        perf.stop(logger, "host " + job.host);
+    }
+    
+    // A host job the pool has stopped waiting for; shared with the thread
+    // still running it
+    struct FleetAttempt {
+        FleetResult result;
+        atomic<bool> abandoned{false};
+    };
+    
+    // Push locale resets to remote machines over RegConnectRegistry. At most
+    // max_remote_connections hosts (or --jobs) are in flight, and each host's
+    // result is appended to the JSON Lines report the moment it finishes, so
+    // a few slow or unreachable hosts never hold back the rest.
+    bool applyFleet(const string& hostsPath, int jobs, const string& reportPath) {
+        shared_ptr<const Config> config = currentConfig();
+        ifstream hosts(hostsPath);
+        if (!hosts.is_open()) {
+            logger.error("Cannot open hosts file: {}", hostsPath);
+            errorCount++;
+            return false;
+        }
+        
+        size_t workers = jobs > 0 ? static_cast<size_t>(jobs)
+                       : static_cast<size_t>(max(1, config->max_remote_connections));
+        string report = reportPath.empty() ? hostsPath + ".report.jsonl" : reportPath;
+        ofstream out(report, ios::trunc);
+        if (!out.is_open()) {
+            logger.warn("Cannot write fleet report: {}", report);
+        }
+        logger.info("Running fleet {} with {} concurrent connection(s)", hostsPath, workers);
+        
+        mutex reportMutex;
+        size_t finished = 0;
+        size_t failed = 0;
+        auto publish = [&](const FleetHost& job, const FleetResult& result) {
+            lock_guard<mutex> lock(reportMutex);
+            if (out.is_open()) {
+                out << "{\"line\":" << job.line
+                    << ",\"host\":\"" << jsonEscape(job.host) << "\""
+                    << ",\"locale\":\"" << jsonEscape(result.locale) << "\""
+                    << ",\"status\":\"" << result.status << "\""
+                    << ",\"profiles\":" << result.profiles
+                    << ",\"profiles_failed\":" << result.profilesFailed
+                    << ",\"changed\":" << result.changed
+                    << ",\"duration_us\":" << result.durationUs
+                    << ",\"error\":\"" << jsonEscape(result.error) << "\"}" << endl;
+            }
+            finished++;
+            if (result.status == "failed") failed++;
+            cout << "[" << finished << "] " << job.host << ": " << result.status
+                 << (result.error.empty() ? "" : " (" + result.error + ")") << "\n";
+        };
+        
+        PerformanceMonitor perf = startOperation();
+        ensureLocales();
+        reportStartup(perf);
+        auto started = chrono::steady_clock::now();
+        chrono::milliseconds hostDeadline(config->remote_host_timeout_ms);
+        {
+            // deque keeps element addresses stable while workers use them
+            deque<FleetHost> jobList;
+            WorkStealingPool pool(workers);
+            // Hosts past their deadline finish their current profile here,
+            // off the pool; joined before jobList goes away
+            mutex stragglersMutex;
+            deque<future<void>> stragglers;
+            string line;
+            size_t lineNumber = 0;
+            while (getline(hosts, line)) {
+                lineNumber++;
+                vector<string> fields = manifestFields(line);
+                if (fields.empty()) continue;
+                jobList.emplace_back();
+                FleetHost& job = jobList.back();
+                job.line = lineNumber;
+                job.host = fields[0];
+                job.locale = fields.size() > 1 ? fields[1] : config->default_locale;
+                if (fields.size() > 2) {
+                    FleetResult rejected;
+                    rejected.locale = job.locale;
+                    rejected.error = "too many fields";
+                    operationCount++;
+                    errorCount++;
+                    publish(job, rejected);
+                    continue;
+                }
+                pool.submit([this, &job, &publish, hostDeadline, &stragglersMutex, &stragglers] {
+                    FleetResult result;
+                    auto attempt = make_shared<FleetAttempt>();
+                    auto run = [this, &job, attempt] {
+                        try {
+                            runFleetHost(job, attempt->result, attempt->abandoned);
+                        } catch (const exception& e) {
+                            attempt->result.error = e.what();
+                        }
+                    };
+                    if (hostDeadline.count() <= 0) {
+                        run();
+                        result = attempt->result;
+                    } else {
+                        // A remote call can stall far past the connect timeout;
+                        // the host's slot and report line are not held for it
+                        future<void> running = async(launch::async, run);
+                        if (running.wait_for(hostDeadline) == future_status::ready) {
+                            running.get();
+                            result = attempt->result;
+                        } else {
+                            attempt->abandoned = true;
+                            result.locale = job.locale;
+                            result.error = "timed out after " + to_string(hostDeadline.count()) + " ms";
+                            logger.error("Host {} {}; stopping after its current profile", job.host, result.error);
+                            lock_guard<mutex> lock(stragglersMutex);
+                            stragglers.push_back(move(running));
+                        }
+                    }
+                    if (result.status == "failed") {
+                        errorCount++;
+                    } else {
+                        successCount++;
+                    }
+                    publish(job, result);
+                });
+            }
+            pool.wait();
+            if (!stragglers.empty()) {
+                logger.info("Waiting for {} timed out host(s) to finish their current profile", stragglers.size());
+            }
+        }
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+        
+        // Remote sessions cannot receive our WM_SETTINGCHANGE; they pick the
+        // values up at next sign-in or settings refresh
+        logger.info("Fleet finished in {} ms: {} host(s), {} failed; report: {}", elapsed.count(), finished, failed, report);
+        perf.stop(logger, "fleet " + hostsPath);
+        return failed == 0;
+    }
+    
+    static constexpr DWORD kSettingsPollMs = 2000;    // how often --watch checks the settings files
+    
+    // Stay resident and put HKCU\Control Panel\International back to
+    // default_locale whenever something else changes it. The wait is on an
+    // event armed by RegNotifyChangeKeyValue, so an idle agent uses almost no
+    // CPU. Every kSettingsPollMs the settings files are checked as well, and
+    // edits are picked up through reloadSettings() without a restart.
+    bool watch() {
+        shared_ptr<const Config> config = currentConfig();
+        string locale;
+        PinnedLocale info;
+        if (!resolveLocale(config->default_locale, locale, info)) {
+            logger.error("Unsupported default_locale for --watch: {}", config->default_locale);
+            errorCount++;
+            return false;
+        }
+#ifdef _WIN32
+        RegistryKeyGuard watched;
+        if (!watched.openForRead(HKEY_CURRENT_USER, kIntlKey, KEY_NOTIFY | KEY_QUERY_VALUE)) {
+            logger.error("Cannot open HKEY_CURRENT_USER\\{} for change notification", kIntlKey);
+            errorCount++;
+            return false;
+        }
+        HANDLE changed = CreateEventW(NULL, FALSE, FALSE, NULL);
+        if (changed == NULL) {
+            logger.error("Cannot create change notification event");
+            errorCount++;
+            return false;
+        }
+        
+        shared_ptr<const RegistryBatch> target = encodedLocaleBatch(locale, info);
+        uint64_t stamp = settingsStamp();
+        bool armed = false;
+        logger.info("Watching HKEY_CURRENT_USER\\{} for drift from {} (Ctrl+C to stop)", kIntlKey, locale);
+        while (true) {
+            if (!armed) {
+                // Arm before reading, so a change racing the correction still wakes
+                // the wait; our own writes then cost one read with an empty diff
+                LONG status = RegNotifyChangeKeyValue(watched.get(), FALSE, REG_NOTIFY_CHANGE_LAST_SET, changed, TRUE);
+                if (status != ERROR_SUCCESS) {
+                    logger.error("RegNotifyChangeKeyValue failed (Error: {})", status);
+                    break;
+                }
+                armed = true;
+                correctDrift(watched.get(), locale, *target);
+            }
+            if (WaitForSingleObject(changed, kSettingsPollMs) == WAIT_OBJECT_0) {
+                armed = false;
+                // Control Panel writes its values one at a time; let the burst settle
+                Sleep(250);
+                continue;
+            }
+            
+            // Edited settings files are picked up without a restart
+            uint64_t current = settingsStamp();
+            if (current == stamp) continue;
+            stamp = current;
+            reloadSettings();
+            string configured = currentConfig()->default_locale;
+            if (!resolveLocale(configured, locale, info)) {
+                logger.error("Unsupported default_locale after reload: {}, still enforcing {}", configured, locale);
+            }
+            logger.info("Settings reloaded, enforcing {}", locale);
+            target = encodedLocaleBatch(locale, info);
+            correctDrift(watched.get(), locale, *target);
+        }
+        CloseHandle(changed);
+        errorCount++;
+        return false;
+#else
+        logger.info("Non-Windows platform detected - running in demo mode");
+        cout << "\n[DEMO MODE] Would watch HKEY_CURRENT_USER\\" << kIntlKey << " and restore " << locale
+             << " (" << info.name << ") whenever it drifts\n";
+        return true;
+#endif
+    }
+    
+    // Concurrency check for the shared state, meant to run under TSan
+    // (the CMake stress target). Workers resolve loose tags and apply them
+    // against the in-memory registry through the shared locale and batch
+    // caches, each with its own performance context, while another thread
+    // keeps republishing the config and locale snapshots. Every worker owns
+    // one hive, which must hold its last locale exactly at the end.
+    bool stress(size_t threads, size_t rounds) {
+        ensureLocales();
+        if (threads == 0) threads = max(2u, thread::hardware_concurrency());
+        vector<string> tags;
+        for (const auto& locale : allLocales()) {
+            string tag(locale.tag);
+            string loose = tag;
+            replace(loose.begin(), loose.end(), '-', '_');
+            for (char& c : loose) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            tags.push_back(tag);
+            tags.push_back(loose);
+            tags.push_back(tag.substr(0, tag.find('-')));
+        }
+        logger.info("Stress: {} thread(s) x {} apply(s) over {} tag(s), settings republished concurrently", threads, rounds, tags.size());
+        logger.setMinLevel(LogLevel::Warn);
+        
+        MockRegistryBackend backend(chrono::microseconds(0));
+        Logger quiet("", false, false);
+        vector<shared_ptr<const RegistryBatch>> last(threads);
+        atomic<size_t> failures(0);
+        atomic<size_t> running(threads);
+        atomic<size_t> reloads(0);
+        auto started = chrono::steady_clock::now();
+        {
+            vector<thread> workers;
+            for (size_t t = 0; t < threads; t++) {
+                workers.emplace_back([&, t] {
+                    HKEY root = reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x2000 + t));
+                    for (size_t i = 0; i < rounds; i++) {
+                        operationCount++;
+                        PerformanceMonitor perf = startOperation();
+                        shared_ptr<const Config> config = currentConfig();
+                        string locale;
+                        PinnedLocale info;
+                        if (!resolveLocale(tags[(t * 7 + i) % tags.size()], locale, info)) {
+                            errorCount++;
+                            failures++;
+                            continue;
+                        }
+                        ApplyArena::Scope scratch("stress");
+                        shared_ptr<const RegistryBatch> encoded = encodedLocaleBatch(locale, info);
+                        const RegistryBatch& full = *encoded;
+                        RegistrySnapshot current;
+                        RegistryBatchView changes(scratch.resource());
+                        {
+                            auto timer = perf.phase("registry_read");
+                            if (backend.readValues(root, kIntlKey, current)) RegistryDiff::delta(full, current, changes);
+                            else changes.addAll(full);
+                        }
+                        RegistryBatch::Result result;
+                        {
+                            auto timer = perf.phase("registry_writes");
+                            result = changes.apply(quiet, config->transactional_writes, root, backend);
+                        }
+                        if (result.failed > 0) {
+                            errorCount++;
+                            failures++;
+                            continue;
+                        }
+                        successCount++;
+                        last[t] = encoded;
+                    }
+                    running--;
+                });
+            }
+            thread reloader([&] {
+                while (running.load() > 0) {
+                    publishConfig(*currentConfig());
+                    republishLocales();
+                    reloads++;
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+            });
+            for (auto& worker : workers) worker.join();
+            reloader.join();
+        }
+        auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - started);
+        
+        size_t mismatched = 0;
+        for (size_t t = 0; t < threads; t++) {
+            if (last[t] == nullptr) continue;
+            RegistrySnapshot stored;
+            HKEY root = reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x2000 + t));
+            if (!backend.readValues(root, kIntlKey, stored) || !RegistryDiff::delta(*last[t], stored).empty()) mismatched++;
+        }
+        logger.setMinLevel(LogLevel::Info);
+        logger.info("Stress finished in {} ms: {} apply(s), {} reload(s), {} failure(s), {} hive(s) not matching their last apply",
+                    elapsed.count(), threads * rounds, reloads.load(), failures.load(), mismatched);
+        return failures == 0 && mismatched == 0;
+    }
+    
+    // Generate the binary locale catalog from the built-in table and custom_locales.json
+    bool compileCatalog(const string& outputPath) {
+        shared_ptr<const Config> config = currentConfig();
+        string path = outputPath.empty() ? config->locale_catalog : outputPath;
+        if (path.empty()) path = "locales.rcat";
+        // Always from the JSON sources, even when a current catalog is mapped
+        vector<PinnedLocale> pinned = loadSourceLocales();
+        vector<LocaleView> locales(pinned.begin(), pinned.end());
+        if (!LocaleCatalog::compile(locales, path, "custom_locales.json", kBuiltinLocalesHash)) {
+            logger.error("Failed to write locale catalog: {}", path);
+            return false;
+        }
+        logger.info("Compiled {} locales into {}", locales.size(), path);
+        return true;
+    }
+    
+    // Resolve a snapshot reference: a snapshot file, a store id or prefix, or
+    // (empty) the latest International snapshot of the current user
+    bool loadSnapshot(const string& snapshotRef, RegistrySnapshot& snapshot, string& scope, string& label) {
+        scope = "HKEY_CURRENT_USER\\Control Panel\\International";
+        label = snapshotRef.empty() ? "latest" : snapshotRef;
+        error_code ec;
+        if (!snapshotRef.empty() && fs::is_regular_file(snapshotRef, ec)) {
+            return NativeBackup::load(snapshotRef, snapshot);
+        }
+        BackupStore::Entry entry;
+        bool found = snapshotRef.empty() ? (backupStore.latest(entry, scope) || backupStore.latest(entry))
+                                         : backupStore.find(snapshotRef, entry);
+        if (!found) return false;
+        scope = entry.scope;
+        label = entry.id;
+        return backupStore.load(entry.id, snapshot);
+    }
+    
+    // Restore a snapshot from the backup store by id (default: the newest
+    // International snapshot of the current user) or from a loose .rsnap
+    // file. Only values that differ from the live registry are written, and
+    // values the snapshot records as absent (created since) are deleted.
+    bool rollback(const string& snapshotRef) {
+        shared_ptr<const Config> config = currentConfig();
+        operationCount++;
+        PerformanceMonitor perf = startOperation();
+        reportStartup(perf);
+        string scope;
+        string label;
+        RegistrySnapshot snapshot;
+        bool loaded;
+        {
+            auto timer = perf.phase("snapshot_load");
+            loaded = loadSnapshot(snapshotRef, snapshot, scope, label);
+        }
+        if (!loaded) {
+            logger.error("Snapshot not found or unreadable: {}", label);
+            errorCount++;
+            return false;
+        }
+        
+        RegistryBatch batch;
+        NativeBackup::toBatch(snapshot, batch);
+        // The scope is "<owner>\\<backed up key>"; the owner is a root name, a
+        // SID or, for a hive named by path, the hive file itself
+        string owner = scope.substr(0, scope.find('\\'));
+        for (const auto& key : snapshot.keys) {
+            if (scope.size() > key.path.size() + 1 && scope.compare(scope.size() - key.path.size(), key.path.size(), key.path) == 0 &&
+                scope[scope.size() - key.path.size() - 1] == '\\') {
+                owner = scope.substr(0, scope.size() - key.path.size() - 1);
+                break;
+            }
+        }
+#ifdef _WIN32
+        ProfileHive hive;
+        RegistryTarget target = RegistryTarget::currentUser();
+        if (owner != target.rootName) {
+            UserProfile profile;
+            bool known = false;
+            if (owner.find_first_of("\\/:") != string::npos) {
+                profile = UserProfile::forHive(owner);
+                known = true;
+            } else {
+                vector<UserProfile> profiles = ProfileEnumerator::enumerate(true);
+                auto found = find_if(profiles.begin(), profiles.end(), [&](const UserProfile& p) { return p.sid == owner; });
+                if (found != profiles.end()) {
+                    profile = *found;
+                    known = true;
+                }
+            }
+            LONG status = ERROR_FILE_NOT_FOUND;
+            if (known) {
+                if (!profile.loaded) {
+                    ProfileEnumerator::enablePrivilege(SE_BACKUP_NAME);
+                    ProfileEnumerator::enablePrivilege(SE_RESTORE_NAME);
+                }
+                status = hive.open(profile);
+            }
+            if (status != ERROR_SUCCESS) {
+                logger.error("Cannot open profile {} for snapshot {} (Error: {})", owner, label, status);
+                errorCount++;
+                return false;
+            }
+            target = hive.target(profile);
+        }
+        
+        RegistrySnapshot removals;
+        {
+            auto timer = perf.phase("registry_read");
+            RegistrySnapshot live = readLiveValues(target.root, snapshot);
+            batch = RegistryDiff::delta(batch, live);
+            removals = RegistryDiff::resurrected(snapshot, live);
+        }
+        if (batch.empty() && removals.keys.empty()) {
+            successCount++;
+            logger.info("Registry already matches snapshot {}, nothing to roll back", label);
+            perf.stop(logger, "rollback " + label);
+            return true;
         }
         
-        HKEY get() const { return hKey; }
-        bool isValid() const { return valid; }
-        
-        ~RegistryKeyGuard() {
-            if (valid && hKey != NULL) {
-                RegCloseKey(hKey);
+        logger.info("Rolling back {} value(s) and removing {} in {} from snapshot {}", batch.size(), removals.valueCount(),
+                    target.rootName, label);
+        RegistryBatch::Result result;
+        {
+            auto timer = perf.phase("registry_writes");
+            if (!batch.empty()) result = batch.apply(logger, config->transactional_writes, target.root);
+            // Values the apply created; deleted outside the transaction, once the writes are in
+            if (result.failed == 0) {
+                size_t failed = 0;
+                result.applied += NativeBackup::removeValues(target.root, removals, failed);
+                result.failed += failed;
             }
         }
-        
-        // Prevent copying
-        RegistryKeyGuard(const RegistryKeyGuard&) = delete;
-        RegistryKeyGuard& operator=(const RegistryKeyGuard&) = delete;
-    };
-    
-    bool setRegistryValue(const string& key, const string& valueName, const string& valueData, DWORD type = REG_SZ) {
-        RegistryKeyGuard keyGuard;
-        if (!keyGuard.open(key)) {
-            logger.error("Failed to open registry key: " + key);
-            return false;
+#else
+        logger.info("Non-Windows platform detected - running in demo mode");
+        cout << "\n[DEMO MODE] Would restore the following values for " << owner << " from snapshot " << label << ":\n";
+        RegistryBatch::Result result;
+        {
+            auto timer = perf.phase("registry_writes");
+            result = batch.apply(logger, config->transactional_writes);
         }
-        
-        LONG result;
-        if (type == REG_SZ) {
-            result = RegSetValueExA(keyGuard.get(), valueName.c_str(), 0, REG_SZ, (const BYTE*)valueData.c_str(), static_cast<DWORD>(valueData.size() + 1));
-        } else if (type == REG_DWORD) {
-            try {
-                DWORD value = stoul(valueData);
-                result = RegSetValueExA(keyGuard.get(), valueName.c_str(), 0, REG_DWORD, (const BYTE*)&value, sizeof(DWORD));
-            } catch (const exception& e) {
-                logger.error("Invalid DWORD value: " + valueData + " - " + e.what());
-                return false;
+        result.applied = batch.size();
+        for (const auto& key : snapshot.keys) {
+            for (const auto& value : key.values) {
+                if (value.absent()) cout << "  " << key.path << "\\" << value.name << " (deleted)\n";
             }
-        } else {
-            logger.error("Unsupported registry type: " + to_string(type));
-            return false;
         }
-        
-        if (result == ERROR_SUCCESS) {
-            logger.debug("Set registry: " + key + "\\" + valueName + " = " + valueData);
+#endif
+        if (result.failed == 0) {
+            successCount++;
+            logger.info("Rollback completed from snapshot {}", label);
+            notifySettingChange(perf);
+            perf.stop(logger, "rollback " + label);
             return true;
-        } else {
-            logger.error("Failed to set registry value: " + key + "\\" + valueName + " (Error: " + to_string(result) + ")");
-            return false;
         }
+        errorCount++;
+        logger.error(result.rolledBack ? "Rollback from {} failed, no values changed" : "Rollback from {} partially failed", label);
+        return false;
     }
     
-    bool backupRegistry(const string& keyPath) {
-        if (!config.backup_enabled) return true;
-        
-        string backupFile = backupDir + "/" + 
-            string(keyPath).substr(string(keyPath).find_last_of("\\") + 1) + ".reg";
-        
-        string command = "reg export \"" + keyPath + "\" \"" + backupFile + "\" /y";
-        int result = system(command.c_str());
-        
-        if (result == 0) {
-            logger.info("Backed up: " + keyPath);
-            return true;
-        } else {
-            logger.warn("Failed to backup: " + keyPath);
+    // Diff a locale against a baseline once and save the needed writes as a
+    // plan. The baseline is the live HKCU values, or a snapshot (file or
+    // store id) standing in for a fleet's common starting state.
+    bool createPlan(const string& requested, const string& outPath, const string& baselineRef) {
+        operationCount++;
+        PerformanceMonitor perf = startOperation();
+        string locale;
+        PinnedLocale info;
+        bool resolved = resolveLocale(requested, locale, info);
+        reportStartup(perf);
+        if (!resolved) {
+            reportUnsupported(requested);
+            errorCount++;
             return false;
         }
-    }
-#endif
-    
-public:
-    RegionalSettingsManager() : logger("", true), operationCount(0), successCount(0), errorCount(0) {
-        loadConfig();
-        backupDir = "backup_" + getCurrentTimestamp();
         
-        if (config.backup_enabled) {
-            try {
-                fs::create_directories(backupDir);
-                logger.info("Created backup directory: " + backupDir);
-            } catch (const exception& e) {
-                logger.warn("Failed to create backup directory: " + string(e.what()));
-                config.backup_enabled = false;
+        shared_ptr<const RegistryBatch> encoded = encodedLocaleBatch(locale, info);
+        const RegistryBatch& target = *encoded;
+        ChangePlan plan;
+        plan.locale = locale;
+        RegistrySnapshot baseline;
+        {
+            auto timer = perf.phase(baselineRef.empty() ? "registry_read" : "snapshot_load");
+            if (!baselineRef.empty()) {
+                string scope;
+                if (!loadSnapshot(baselineRef, baseline, scope, plan.baseline)) {
+                    logger.error("Baseline snapshot not found or unreadable: {}", baselineRef);
+                    errorCount++;
+                    return false;
+                }
+            } else {
+#ifdef _WIN32
+                baseline = readLiveValues(HKEY_CURRENT_USER, target);
+#else
+                cout << "\n[DEMO MODE] No live registry to read; planning against an empty baseline\n";
+#endif
+                plan.baseline = liveBaselineId(baseline);
             }
         }
+        
+        string path = outPath.empty() ? locale + ".rplan" : outPath;
+        if (!ChangePlan::fromBatch(RegistryDiff::delta(target, baseline), plan) || !plan.save(path)) {
+            logger.error("Failed to write plan: {}", path);
+            errorCount++;
+            return false;
+        }
+        successCount++;
+        logger.info("Plan {}: {} write(s) for {} on baseline {}", path, plan.size(), locale, plan.baseline);
+        perf.stop(logger, "plan " + locale);
+        return true;
     }
     
-    void printBanner() {
-        cout << "\n================================================\n";
-        cout << " Windows Regional Settings Reset - C++ Edition\n";
-        cout << "                    v2.1\n";
-        cout << "================================================\n";
-        logger.info("Regional Settings Manager started");
+    // Fingerprint of the values only, so equal machines get equal plans
+    static string liveBaselineId(RegistrySnapshot values) {
+        values.capturedAt = 0;
+        vector<uint8_t> image = NativeBackup::serialize(values);
+        stringstream id;
+        id << "live-" << std::hex << setw(16) << setfill('0') << fnv1a64(image.data(), image.size());
+        return id.str();
     }
     
-    void listLocales() {
-        cout << "\nSupported Locales:\n";
-        cout << "==================\n";
-        for (const auto& kv : supportedLocales) {
-            cout << "  " << kv.first << " - " << kv.second.name << "\n";
+    // A plan file is input from elsewhere: it may only write the International
+    // values --plan can produce. Empty when the plan is acceptable.
+    static string planViolation(const ChangePlan& plan) {
+        for (const auto& key : plan.ops.keys) {
+            if (key.path != kIntlKey) return "writes outside " + string(kIntlKey) + ": " + key.path;
+            for (const auto& value : key.values) {
+                if (value.type != REG_SZ && value.type != REG_DWORD) {
+                    return "unsupported type " + to_string(value.type) + " for " + value.name;
+                }
+            }
         }
-        cout << "\n";
+        return string();
     }
     
-    bool applyLocale(const string& locale, bool force = false) {
-        operationCount++;
-        perfMonitor.start();
-        
-        if (supportedLocales.find(locale) == supportedLocales.end()) {
-            // Optimize string concatenation
-            string error = "Unsupported locale: ";
-            error.reserve(error.size() + locale.size());
-            error += locale;
-            logger.error(error);
-            listLocales();
-            errorCount++;
+    // Whether live still is the state plan was diffed against: the same
+    // fingerprint for a live baseline; for a store snapshot, every value it
+    // recorded (present or absent) as it was
+    bool baselineHolds(const ChangePlan& plan, const RegistrySnapshot& live) {
+        if (plan.baseline.compare(0, 5, "live-") == 0) return liveBaselineId(live) == plan.baseline;
+        RegistrySnapshot snapshot;
+        string scope, label;
+        if (!loadSnapshot(plan.baseline, snapshot, scope, label)) {
+            logger.error("Baseline snapshot {} is not in {}, cannot verify it", plan.baseline, backupStore.path());
             return false;
         }
-        
-        const LocaleInfo& info = supportedLocales[locale];
-        // Use stringstream for efficient multi-part concatenation
-        stringstream logMsg;
-        logMsg << "Applying settings for locale: " << locale << " (" << info.name << ")";
-        logger.info(logMsg.str());
-        
-        if (!force) {
-            cout << "\nThis will change all regional settings to: " << info.name << "\n";
-            cout << "Continue? (y/N): ";
-            string confirm;
-            getline(cin, confirm);
-            if (confirm != "y" && confirm != "Y") {
-                logger.info("Operation cancelled by user");
+        RegistryBatch recorded;
+        NativeBackup::toBatch(snapshot, recorded);
+        return RegistryDiff::delta(recorded, live).empty() && RegistryDiff::resurrected(snapshot, live).keys.empty();
+    }
+    
+    // Execute a plan from --plan for the current user: no locale lookup, no
+    // JSON and no diff, only the recorded writes (backed up first if enabled).
+    // The plan runs only while the live values still match its baseline.
+    bool applyPlan(const string& path) {
+        shared_ptr<const Config> config = currentConfig();
+        operationCount++;
+        PerformanceMonitor perf = startOperation();
+        reportStartup(perf);
+        ChangePlan plan;
+        RegistryBatch batch;
+        {
+            auto timer = perf.phase("plan_load");
+            if (!ChangePlan::load(path, plan)) {
+                logger.error("Plan not found or corrupt: {}", path);
+                errorCount++;
                 return false;
             }
-        }
-        
-#ifdef _WIN32
-        logger.info("Windows detected - using registry API");
-        
-        if (config.backup_enabled) {
-            backupRegistry("HKEY_CURRENT_USER\\Control Panel\\International");
-        }
-        
-        vector<pair<pair<string, string>, pair<string, DWORD>>> settings = {
-            {{"Control Panel\\International", "LocaleName"}, {locale, REG_SZ}},
-            {{"Control Panel\\International", "sCountry"}, {info.country, REG_SZ}},
-            {{"Control Panel\\International", "sShortDate"}, {info.shortDate, REG_SZ}},
-            {{"Control Panel\\International", "sLongDate"}, {info.longDate, REG_SZ}},
-            {{"Control Panel\\International", "sTimeFormat"}, {info.timeFormat, REG_SZ}},
-            {{"Control Panel\\International", "sCurrency"}, {info.currency, REG_SZ}},
-            {{"Control Panel\\International", "sDecimal"}, {info.decimalSep, REG_SZ}},
-            {{"Control Panel\\International", "sThousand"}, {info.thousandSep, REG_SZ}},
-            {{"Control Panel\\International", "sList"}, {info.listSep, REG_SZ}},
-            {{"Control Panel\\International", "iCountry"}, {to_string(info.countryCode), REG_DWORD}}
-        };
-        
-        int localSuccessCount = 0;
-        for (const auto& setting : settings) {
-            if (setRegistryValue(setting.first.first, setting.first.second, 
-                               setting.second.first, setting.second.second)) {
-                localSuccessCount++;
+            string violation = planViolation(plan);
+            if (!violation.empty()) {
+                logger.error("Refusing plan {}: {}", path, violation);
+                errorCount++;
+                return false;
             }
+            batch = plan.batch();
         }
-        
-        logger.info("Registry operations: " + to_string(localSuccessCount) + "/" + to_string(settings.size()) + " successful");
-        
-        if (localSuccessCount == settings.size()) {
+        logger.info("Applying plan {}: {} write(s) for {} (baseline {})", path, batch.size(), plan.locale, plan.baseline);
+        if (batch.empty()) {
             successCount++;
-            logger.info("Successfully configured " + locale);
-            cout << "\n[SUCCESS] Regional settings updated for " << locale << "\n";
-            cout << "Note: A system restart may be required for all changes to take effect.\n";
-            perfMonitor.stop(logger);
+            perf.stop(logger, "plan " + path);
             return true;
-        } else {
+        }
+        
+        // One read serves the baseline check and the backup
+        RegistryTarget target = RegistryTarget::currentUser();
+        RegistrySnapshot live;
+#ifdef _WIN32
+        {
+            auto timer = perf.phase("registry_read");
+            live = readLiveValues(target.root, batch);
+        }
+#endif
+        if (!baselineHolds(plan, live)) {
+            logger.error("Plan {} was made for baseline {}, which the registry no longer matches (now {}); generate a new plan with --plan",
+                         path, plan.baseline, liveBaselineId(live));
             errorCount++;
-            logger.error("Partial failure configuring " + locale);
             return false;
         }
+#ifdef _WIN32
+        if (config->backup_enabled) {
+            auto timer = perf.phase("backup");
+            RegistrySnapshot overwritten = RegistryDiff::affected(live, batch);
+            if (!backupRegistry(*config, target, kIntlKey, &overwritten)) {
+                logger.error("Backup failed, plan {} not applied", path);
+                errorCount++;
+                return false;
+            }
+        }
 #else
         logger.info("Non-Windows platform detected - running in demo mode");
-        cout << "\n[DEMO MODE] Would set the following registry values for " << locale << ":\n";
-        cout << "  LocaleName = " << locale << "\n";
-        cout << "  sCountry = " << info.country << "\n";
-        cout << "  sShortDate = " << info.shortDate << "\n";
-        cout << "  sLongDate = " << info.longDate << "\n";
-        cout << "  sTimeFormat = " << info.timeFormat << "\n";
-        cout << "  sCurrency = " << info.currency << "\n";
-        cout << "  sDecimal = " << info.decimalSep << "\n";
-        cout << "  sThousand = " << info.thousandSep << "\n";
-        cout << "  sList = " << info.listSep << "\n";
-        cout << "  iCountry = " << info.countryCode << "\n";
-        cout << "\n[SUCCESS] Demo mode completed for " << locale << "\n";
-        successCount++;
-        logger.info("Demo mode completed successfully for " + locale);
-        perfMonitor.stop(logger);
-        return true;
+        cout << "\n[DEMO MODE] Would execute plan " << path << " for " << plan.locale << ":\n";
 #endif
+        RegistryBatch::Result result;
+        {
+            auto timer = perf.phase("registry_writes");
+            result = batch.apply(logger, transactional(*config, target), target.root);
+        }
+        perf.stop(logger, "plan " + path);
+        if (result.failed == 0) {
+            successCount++;
+            notifySettingChange(perf);
+            return true;
+        }
+        errorCount++;
+        logger.error(result.rolledBack ? "Plan {} failed, no values changed" : "Plan {} partially failed", path);
+        return false;
+    }
+    
+    bool verifyBackups() {
+        operationCount++;
+        BackupArchive::VerifyResult result = backupStore.verify();
+        if (result.checked == 0) {
+            logger.warn("No archived snapshots found in {}", backupStore.path());
+        } else if (result.corrupt == 0) {
+            logger.info("Verified {} archived snapshot(s) in {}", result.checked, backupStore.path());
+        } else {
+            logger.error("{} of {} archived snapshot(s) failed their checksum", result.corrupt, result.checked);
+        }
+        if (!result.damage.empty()) {
+            logger.error("Archive {}/objects.pack: {}; it and later entries were not checked", backupStore.path(), result.damage);
+        }
+        if (result.corrupt == 0 && result.damage.empty()) {
+            successCount++;
+            return true;
+        }
+        errorCount++;
+        return false;
     }
     
     void showStatistics() {
+        shared_ptr<const Config> config = currentConfig();
         cout << "\n=== Execution Statistics ===\n";
         cout << "Total Operations: " << operationCount.load() << "\n";
         cout << "Successful: " << successCount.load() << "\n";
@@ -462,13 +7273,27 @@ public:
             double successRate = (double)successCount.load() / operationCount.load() * 100;
             cout << "Success Rate: " << fixed << setprecision(1) << successRate << "%\n";
         }
-        if (config.backup_enabled) {
-            cout << "Backup Directory: " << backupDir << "\n";
+        int profileTotal = profilesUpdated.load() + profilesCompliant.load() + profilesFailed.load();
+        if (profileTotal > 0) {
+            cout << "Profiles Processed: " << profileTotal << " (" << profilesUpdated.load() << " updated, "
+                 << profilesCompliant.load() << " already compliant, " << profilesFailed.load() << " failed)\n";
+            lock_guard<mutex> lock(profileResultsMutex);
+            for (const auto& sid : failedProfiles) {
+                cout << "  Failed: " << sid << "\n";
+            }
+        }
+        if (retriesScheduled.load() > 0 || retriesExhausted.load() > 0) {
+            cout << "Retries: " << retriesScheduled.load() << " scheduled, " << retriesRecovered.load() << " recovered, "
+                 << retriesExhausted.load() << " exhausted (+" << retryBackoffMs.load() << " ms backoff)\n";
+        }
+        if (config->backup_enabled && backupStore.isOpen()) {
+            cout << "Backup Store: " << backupStore.path() << "\n";
         }
         cout << "\n";
     }
     
     void interactiveMenu() {
+        shared_ptr<const Config> config = currentConfig();
         string choice;
         
         while (true) {
@@ -483,11 +7308,11 @@ public:
             getline(cin, choice);
             
             if (choice == "1") {
-                cout << "\nEnter locale code (default: " << config.default_locale << "): ";
+                cout << "\nEnter locale code (default: " << config->default_locale << "): ";
                 string locale;
                 getline(cin, locale);
                 if (locale.empty()) {
-                    locale = config.default_locale;
+                    locale = config->default_locale;
                 }
                 applyLocale(locale);
             }
@@ -496,9 +7321,9 @@ public:
             }
             else if (choice == "3") {
                 cout << "\n=== Current Configuration ===\n";
-                cout << "Default Locale: " << config.default_locale << "\n";
-                cout << "Backup Enabled: " << (config.backup_enabled ? "Yes" : "No") << "\n";
-                cout << "Logging Enabled: " << (config.log_enabled ? "Yes" : "No") << "\n";
+                cout << "Default Locale: " << config->default_locale << "\n";
+                cout << "Backup Enabled: " << (config->backup_enabled ? "Yes" : "No") << "\n";
+                cout << "Logging Enabled: " << (config->log_enabled ? "Yes" : "No") << "\n";
                 cout << "\n";
             }
             else if (choice == "4") {
@@ -515,31 +7340,782 @@ public:
     }
 };
 
+// Built-in benchmark harness. Drives the real batch, diff, backup store and
+// logger code against the in-memory registry so results are comparable
+// across machines and runs, and never touch a live hive.
+class Benchmark {
+private:
+    static constexpr size_t kApplyOps = 4000;
+    static constexpr size_t kProfiles = 64;
+    static constexpr size_t kBackupSnapshots = 1000;
+    static constexpr size_t kLogMessages = 50000;
+    
+    size_t maxThreads;
+    chrono::microseconds latency;
+    
+    // Discards console echo so logger runs measure the file path only
+    struct NullBuffer : streambuf {
+        int overflow(int c) override { return c; }
+    };
+    
+    static double seconds(chrono::steady_clock::time_point started) {
+        return chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    }
+    
+    static string rate(double count, double elapsed) {
+        stringstream out;
+        out << fixed << setprecision(1) << (elapsed > 0 ? count / elapsed : 0.0);
+        return out.str();
+    }
+    
+    static string number(double value) {
+        stringstream out;
+        out << fixed << setprecision(4) << value;
+        return out.str();
+    }
+    
+    // Alternate two locales per profile so every apply has a real diff
+    string applyRun(size_t threads) {
+        MockRegistryBackend backend(latency);
+        Logger quiet("", false, false);
+        const LocaleView& first = kBuiltinLocales[0];
+        const LocaleView& second = kBuiltinLocales[1];
+        RegistryBatch batches[2] = {
+            RegionalSettingsManager::localeBatch(string(first.tag), first),
+            RegionalSettingsManager::localeBatch(string(second.tag), second),
+        };
+        atomic<size_t> written(0);
+        atomic<size_t> failed(0);
+        
+        auto started = chrono::steady_clock::now();
+        {
+            WorkStealingPool pool(threads);
+            for (size_t op = 0; op < kApplyOps; op++) {
+                pool.submit([&, op] {
+                    HKEY root = reinterpret_cast<HKEY>(static_cast<uintptr_t>(0x1000 + op % kProfiles));
+                    RegistrySnapshot current;
+                    RegistryBatch batch = backend.readValues(root, RegionalSettingsManager::kIntlKey, current)
+                        ? RegistryDiff::delta(batches[(op / kProfiles) % 2], current)
+                        : batches[(op / kProfiles) % 2];
+                    RegistryBatch::Result result = batch.apply(quiet, true, root, backend);
+                    written += result.applied;
+                    failed += result.failed;
+                });
+            }
+            pool.wait();
+        }
+        double elapsed = seconds(started);
+        
+        return "{\"threads\": " + to_string(threads) + ", \"applies\": " + to_string(kApplyOps) +
+               ", \"values_written\": " + to_string(written.load()) + ", \"failed\": " + to_string(failed.load()) +
+               ", \"seconds\": " + number(elapsed) + ", \"applies_per_sec\": " + rate(kApplyOps, elapsed) +
+               ", \"registry_ops\": " + to_string(backend.operationCount()) + "}";
+    }
+    
+    // Commit distinct International snapshots into a scratch store, so the
+    // figure covers serialize, delta encoding, LZ4 and the archive append
+    string backupRun() {
+        fs::path root = fs::temp_directory_path() /
+            ("regreset-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+        size_t rawBytes = 0;
+        size_t committed = 0;
+        double elapsed = 0;
+        {
+            BackupStore store(root.string());
+            RegistrySnapshot snapshot;
+            snapshot.keys.push_back({RegionalSettingsManager::kIntlKey, {}});
+            RegistryBatch values = RegionalSettingsManager::localeBatch(string(kBuiltinLocales[0].tag), kBuiltinLocales[0]);
+            for (const auto& key : values.entries()) {
+                for (const auto& write : key.second) {
+                    snapshot.keys[0].values.push_back({write.valueName, REG_SZ, utf8ToRegistryString(write.data)});
+                }
+            }
+            
+            auto started = chrono::steady_clock::now();
+            for (size_t i = 0; i < kBackupSnapshots; i++) {
+                // One value changes per snapshot, as a typical reset does
+                snapshot.capturedAt = static_cast<int64_t>(i);
+                snapshot.keys[0].values[i % snapshot.keys[0].values.size()].data = utf8ToRegistryString(to_string(i));
+                rawBytes += NativeBackup::serialize(snapshot).size();
+                if (!store.commit(snapshot, "bench").empty()) committed++;
+            }
+            elapsed = seconds(started);
+        }
+        size_t storedBytes = 0;
+        error_code ec;
+        for (const auto& entry : fs::recursive_directory_iterator(root, ec)) {
+            if (entry.is_regular_file(ec)) storedBytes += static_cast<size_t>(entry.file_size(ec));
+        }
+        fs::remove_all(root, ec);
+        
+        return "{\"snapshots\": " + to_string(committed) + ", \"raw_bytes\": " + to_string(rawBytes) +
+               ", \"stored_bytes\": " + to_string(storedBytes) + ", \"seconds\": " + number(elapsed) +
+               ", \"bytes_per_sec\": " + rate(static_cast<double>(rawBytes), elapsed) + "}";
+    }
+    
+    string loggerRun(size_t threads, bool async) {
+        fs::path file = fs::temp_directory_path() /
+            ("regreset-bench-" + to_string(chrono::steady_clock::now().time_since_epoch().count()) + ".log");
+        NullBuffer discard;
+        streambuf* console = cout.rdbuf(&discard);
+        double elapsed = 0;
+        {
+            Logger logger(file.string(), true, async);
+            auto started = chrono::steady_clock::now();
+            vector<thread> writers;
+            for (size_t t = 0; t < threads; t++) {
+                writers.emplace_back([&logger, threads, t] {
+                    for (size_t i = t; i < kLogMessages; i += threads) {
+                        logger.info("Set registry: Control Panel\\International\\sShortDate = dd.MM.yyyy #" + to_string(i));
+                    }
+                });
+            }
+            for (auto& writer : writers) writer.join();
+            logger.flush();
+            elapsed = seconds(started);
+        }
+        cout.rdbuf(console);
+        error_code ec;
+        fs::remove(file, ec);
+        
+        return "{\"threads\": " + to_string(threads) + ", \"async\": " + (async ? "true" : "false") +
+               ", \"messages\": " + to_string(kLogMessages) + ", \"seconds\": " + number(elapsed) +
+               ", \"messages_per_sec\": " + rate(kLogMessages, elapsed) + "}";
+    }
+    
+    // 1, 2, 4, ... up to and including maxThreads
+    vector<size_t> threadSteps() const {
+        vector<size_t> steps;
+        for (size_t threads = 1; threads < maxThreads; threads *= 2) steps.push_back(threads);
+        steps.push_back(maxThreads);
+        return steps;
+    }
+    
+public:
+    Benchmark(size_t maxThreads, chrono::microseconds latency)
+        : maxThreads(maxThreads == 0 ? max<size_t>(1, thread::hardware_concurrency()) : maxThreads),
+          latency(latency) {}
+    
+    // Runs every scenario and returns the results as one JSON document
+    string run() {
+        string json = "{\n  \"backend\": \"mock\",\n  \"latency_us\": " + to_string(latency.count()) +
+                      ",\n  \"hardware_threads\": " + to_string(thread::hardware_concurrency()) + ",\n  \"apply\": [";
+        vector<size_t> steps = threadSteps();
+        for (size_t i = 0; i < steps.size(); i++) {
+            json += string(i == 0 ? "" : ",") + "\n    " + applyRun(steps[i]);
+        }
+        json += "\n  ],\n  \"backup\": " + backupRun() + ",\n  \"logger\": [";
+        for (size_t i = 0; i < steps.size(); i++) {
+            json += string(i == 0 ? "" : ",") + "\n    " + loggerRun(steps[i], true);
+        }
+        json += ",\n    " + loggerRun(1, false) + "\n  ]\n}\n";
+        return json;
+    }
+};
+
+// Built-in round-trip checks for the parsers and on-disk formats, run by
+// --self-test and registered with CTest. Like --bench it needs no config,
+// log file or registry, and scratch files go under the temp directory.
+class SelfTest {
+private:
+    size_t checks = 0;
+    size_t failures = 0;
+    fs::path scratch;
+    
+    void check(bool ok, const string& what) {
+        checks++;
+        if (ok) return;
+        failures++;
+        cout << "  FAIL " << what << "\n";
+    }
+    
+    // Flattens reader events into one line: {, }, [, ], k:<key>, s:<text>,
+    // n:<number>, b:<bool>, null
+    struct EventRecorder : JsonSaxHandler {
+        string events;
+        void add(const string& event) { events += (events.empty() ? "" : " ") + event; }
+        void startObject() override { add("{"); }
+        void endObject() override { add("}"); }
+        void startArray() override { add("["); }
+        void endArray() override { add("]"); }
+        void key(const string& name) override { add("k:" + name); }
+        void stringValue(const string& value) override { add("s:" + value); }
+        void numberValue(double value) override {
+            stringstream out;
+            out << value;
+            add("n:" + out.str());
+        }
+        void boolValue(bool value) override { add(value ? "b:true" : "b:false"); }
+        void nullValue() override { add("null"); }
+    };
+    
+    static bool parseJson(const string& text, string& events, string& error) {
+        istringstream in(text);
+        JsonReader reader(in);
+        EventRecorder recorder;
+        bool ok = reader.parse(recorder);
+        events = recorder.events;
+        error = reader.lastError();
+        return ok;
+    }
+    
+    static constexpr size_t kNestingOk = 32;    // well inside JsonReader::kMaxDepth
+    
+    static string nested(size_t depth) {
+        string events;
+        for (size_t i = 0; i < depth; i++) events += (i == 0 ? "[" : " [");
+        for (size_t i = 0; i < depth; i++) events += " ]";
+        return events;
+    }
+    
+    void jsonAccepts(const string& text, const string& expected) {
+        string events, error;
+        bool ok = parseJson(text, events, error);
+        check(ok && events == expected, "json accepts " + text + (ok ? " -> " + events : ": " + error));
+    }
+    
+    void jsonRejects(const string& text) {
+        string events, error;
+        check(!parseJson(text, events, error) && !error.empty(), "json rejects " + text);
+    }
+    
+    void jsonReader() {
+        jsonAccepts("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"", "s:\"\\/\b\f\n\r\t");
+        jsonAccepts("\"\\u00e9\\u20AC\"", "s:\xC3\xA9\xE2\x82\xAC");
+        jsonAccepts("\"\\uD83D\\uDE00\"", "s:\xF0\x9F\x98\x80");
+        jsonAccepts("\"z\xC5\x82\"", "s:z\xC5\x82");
+        jsonAccepts(" {\"a\": [1, {\"b\": [true, false, null]}], \"c\": {}, \"d\": []}\n",
+                    "{ k:a [ n:1 { k:b [ b:true b:false null ] } ] k:c { } k:d [ ] }");
+        jsonAccepts("[-1.5e3, 0, 42]", "[ n:-1500 n:0 n:42 ]");
+        jsonAccepts(string(kNestingOk, '[') + string(kNestingOk, ']'), nested(kNestingOk));
+        
+        jsonRejects("");
+        jsonRejects("{");
+        jsonRejects("{\"a\" 1}");
+        jsonRejects("{\"a\": 1,}");
+        jsonRejects("{a: 1}");
+        jsonRejects("[1,]");
+        jsonRejects("[1 2]");
+        jsonRejects("\"abc");
+        jsonRejects("\"\\x\"");
+        jsonRejects("\"\\u12G4\"");
+        jsonRejects("\"\\uD83D\\n\"");
+        jsonRejects("tru");
+        jsonRejects("nul");
+        jsonRejects("-");
+        jsonRejects("1 2");
+        jsonRejects(string(200, '['));
+        
+        string events, error;
+        parseJson("{\n\"a\": 1,\n\n x}", events, error);
+        check(error.compare(0, 7, "line 4:") == 0, "json error names the line: " + error);
+    }
+    
+    static vector<uint8_t> readBytes(const string& path) {
+        ifstream in(path, ios::binary);
+        return vector<uint8_t>(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    
+    static void writeBytes(const string& path, const vector<uint8_t>& bytes) {
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+    
+    static void flipByte(const string& path, size_t fromEnd) {
+        vector<uint8_t> bytes = readBytes(path);
+        if (fromEnd < bytes.size()) bytes[bytes.size() - 1 - fromEnd] ^= 0x5A;
+        writeBytes(path, bytes);
+    }
+    
+    static bool sameLocale(const LocaleView& a, const LocaleView& b) {
+        return a.tag == b.tag && a.name == b.name && a.country == b.country && a.shortDate == b.shortDate &&
+               a.longDate == b.longDate && a.timeFormat == b.timeFormat && a.currency == b.currency &&
+               a.decimalSep == b.decimalSep && a.thousandSep == b.thousandSep && a.listSep == b.listSep &&
+               a.countryCode == b.countryCode;
+    }
+    
+    void localeCatalog() {
+        string source = (scratch / "custom_locales.json").string();
+        string path = (scratch / "locales.rcat").string();
+        writeBytes(source, {'{', '}'});
+        vector<LocaleView> locales(begin(kBuiltinLocales), end(kBuiltinLocales));
+        sort(locales.begin(), locales.end(), [](const LocaleView& a, const LocaleView& b) { return a.tag < b.tag; });
+        check(LocaleCatalog::compile(locales, path, source, kBuiltinLocalesHash), "catalog compiles");
+        
+        LocaleCatalog catalog;
+        check(catalog.open(path, source, kBuiltinLocalesHash), "catalog maps with matching built-ins hash");
+        check(catalog.size() == kBuiltinLocaleCount, "catalog holds every built-in locale");
+        for (const LocaleView& expected : kBuiltinLocales) {
+            LocaleView found;
+            check(catalog.find(expected.tag, found) && sameLocale(found, expected), "catalog round-trips " + string(expected.tag));
+        }
+        LocaleView missing;
+        check(!catalog.find("xx-XX", missing), "catalog misses unknown tags");
+        catalog.close();
+        
+        check(!catalog.open(path, source, kBuiltinLocalesHash ^ 1), "catalog with a stale built-ins hash is rejected");
+        check(!catalog.open(path, source, 0), "catalog without a built-ins hash is rejected");
+        writeBytes(source, {'{', ' ', '}'});
+        check(!catalog.open(path, source, kBuiltinLocalesHash), "catalog is stale once custom_locales.json changes");
+        
+        check(LocaleCatalog::compile(locales, path, source, kBuiltinLocalesHash), "catalog recompiles");
+        flipByte(path, 4);
+        check(!catalog.open(path, source, kBuiltinLocalesHash), "catalog with a flipped byte is rejected");
+    }
+    
+    // Order-insensitive: a rebuilt delta chain need not keep value order
+    static bool sameSnapshot(const RegistrySnapshot& a, const RegistrySnapshot& b) {
+        auto flatten = [](const RegistrySnapshot& snapshot) {
+            vector<tuple<string, string, DWORD, vector<uint8_t>>> values;
+            for (const auto& key : snapshot.keys) {
+                for (const auto& value : key.values) values.emplace_back(key.path, value.name, value.type, value.data);
+            }
+            sort(values.begin(), values.end());
+            return values;
+        };
+        return flatten(a) == flatten(b);
+    }
+    
+    static size_t lineCount(const string& path) {
+        ifstream in(path);
+        size_t lines = 0;
+        for (string line; getline(in, line);) lines++;
+        return lines;
+    }
+    
+    // One scope through more states than a delta chain may hold: values
+    // change, disappear and come back, and a subkey and a tombstone come and go
+    static vector<RegistrySnapshot> backupStates() {
+        vector<RegistrySnapshot> states;
+        for (int i = 0; i < 40; i++) {
+            RegistrySnapshot snapshot;
+            snapshot.capturedAt = 1000 + i;
+            snapshot.keys.push_back({"Control Panel\\International", {}});
+            auto& values = snapshot.keys[0].values;
+            values.push_back({"sShortDate", REG_SZ, utf8ToRegistryString("dd.MM.yyyy #" + to_string(i))});
+            values.push_back({"iCountry", REG_SZ, utf8ToRegistryString(to_string(i % 3))});
+            if (i % 4 != 1) values.push_back({"sList", REG_SZ, utf8ToRegistryString(";")});
+            if (i % 5 == 2) values.push_back({"sCreated", RegistrySnapshot::kAbsentType, {}});
+            if (i % 7 < 3) {
+                snapshot.keys.push_back({"Control Panel\\International\\Geo", {}});
+                snapshot.keys[1].values.push_back({"Nation", REG_SZ, utf8ToRegistryString(to_string(i % 7))});
+            }
+            states.push_back(snapshot);
+        }
+        return states;
+    }
+    
+    void backupStore() {
+        string root = (scratch / "backups").string();
+        string scope = "HKEY_CURRENT_USER\\Control Panel\\International";
+        vector<RegistrySnapshot> states = backupStates();
+        vector<string> ids;
+        {
+            BackupStore store(root);
+            for (const auto& state : states) {
+                ids.push_back(store.commit(state, scope));
+                check(!ids.back().empty(), "backup store commits state " + to_string(ids.size() - 1));
+            }
+            check(store.commit(states.back(), scope) == ids.back(), "an unchanged state commits as the latest id");
+        }
+        size_t lines = lineCount(root + "/snapshots.idx");
+        check(lines == states.size(), "one index line per snapshot (" + to_string(lines) + ")");
+        
+        {
+            BackupStore reopened(root);
+            for (size_t i = 0; i < states.size(); i++) {
+                RegistrySnapshot loaded;
+                check(reopened.load(ids[i], loaded) && sameSnapshot(loaded, states[i]),
+                      "delta chain rebuilds state " + to_string(i) + " after reopen");
+            }
+            // Going back to an earlier state reuses its id without growing the index
+            check(reopened.commit(states[3], scope) == ids[3], "an earlier state keeps its id");
+            BackupStore::Entry latest;
+            check(reopened.latest(latest, scope) && latest.id == ids[3], "the earlier state becomes the latest");
+        }
+        check(lineCount(root + "/snapshots.idx") == lines, "recommitting a known snapshot adds no index line");
+        
+        BackupStore again(root);
+        BackupStore::Entry latest;
+        check(again.latest(latest, scope) && latest.id == ids[3], "the latest survives a reopen");
+        RegistrySnapshot next = states[3];
+        next.keys[0].values[0].data = utf8ToRegistryString("yyyy-MM-dd");
+        string id = again.commit(next, scope);
+        RegistrySnapshot loaded;
+        check(!id.empty() && again.load(id, loaded) && sameSnapshot(loaded, next), "a delta on a promoted state rebuilds");
+        check(BackupStore(root).verify().corrupt == 0, "the archive verifies");
+    }
+    
+    bool lz4RoundTrips(const vector<uint8_t>& input) {
+        vector<uint8_t> packed = lz4::compress(input.data(), input.size());
+        vector<uint8_t> output;
+        return lz4::decompress(packed.data(), packed.size(), input.size(), output) && output == input;
+    }
+    
+    void lz4Codec() {
+        mt19937 rng(20240611);
+        auto noise = [&](size_t size) {
+            vector<uint8_t> bytes(size);
+            for (auto& b : bytes) b = static_cast<uint8_t>(rng());
+            return bytes;
+        };
+        check(lz4RoundTrips({}), "lz4 round-trips empty input");
+        check(lz4RoundTrips({7}) && lz4RoundTrips(vector<uint8_t>(13, 7)), "lz4 round-trips input shorter than a match");
+        check(lz4RoundTrips(noise(4096)), "lz4 round-trips incompressible input");
+        for (size_t size : {size_t(65535), size_t(65536), size_t(65537)}) {
+            vector<uint8_t> text(size);
+            for (size_t i = 0; i < size; i++) text[i] = static_cast<uint8_t>("HKCU\\Control Panel\\International"[i % 32]);
+            check(lz4RoundTrips(text), "lz4 round-trips " + to_string(size) + " compressible bytes");
+            check(lz4RoundTrips(noise(size)), "lz4 round-trips " + to_string(size) + " random bytes");
+        }
+        // Repeats at and just past the largest offset a match may use
+        for (size_t distance : {size_t(65535), size_t(65536)}) {
+            vector<uint8_t> block = noise(distance);
+            vector<uint8_t> repeated = block;
+            repeated.insert(repeated.end(), block.begin(), block.end());
+            check(lz4RoundTrips(repeated), "lz4 round-trips a repeat " + to_string(distance) + " bytes back");
+        }
+        vector<uint8_t> zeros(1 << 20, 0);
+        vector<uint8_t> packed = lz4::compress(zeros.data(), zeros.size());
+        vector<uint8_t> output;
+        check(packed.size() < zeros.size() / 100 && lz4::decompress(packed.data(), packed.size(), zeros.size(), output)
+                  && output == zeros, "lz4 compresses a run and round-trips it");
+        check(!lz4::decompress(packed.data(), packed.size() / 2, zeros.size(), output), "lz4 rejects a truncated block");
+        check(!lz4::decompress(packed.data(), packed.size(), zeros.size() - 1, output), "lz4 rejects a wrong raw size");
+    }
+    
+    // Three entries, with the offset where each one starts
+    vector<uint64_t> writeArchive(const string& path, const vector<vector<uint8_t>>& objects) {
+        error_code ec;
+        fs::remove(path, ec);
+        BackupArchive archive;
+        vector<uint64_t> starts;
+        check(archive.open(path), "archive opens empty");
+        for (size_t i = 0; i < objects.size(); i++) {
+            starts.push_back(fs::exists(path, ec) ? fs::file_size(path, ec) : 0);
+            check(archive.append(i + 1, objects[i]), "archive appends object " + to_string(i + 1));
+        }
+        return starts;
+    }
+    
+    void backupArchive() {
+        string path = (scratch / "objects.pack").string();
+        vector<vector<uint8_t>> objects = {vector<uint8_t>(300, 'a'), {1, 2, 3}, vector<uint8_t>(5000, 'z')};
+        error_code ec;
+        
+        // A torn append at the tail is cut off and the archive stays writable
+        writeArchive(path, objects);
+        uint64_t complete = fs::file_size(path, ec);
+        vector<uint8_t> bytes = readBytes(path);
+        vector<uint8_t> torn(bytes.begin(), bytes.begin() + 32 + 10);     // entry 1's header, payload cut short
+        bytes.insert(bytes.end(), torn.begin(), torn.end());
+        writeBytes(path, bytes);
+        BackupArchive archive;
+        check(archive.open(path) && archive.size() == 3 && archive.damage().empty(), "archive drops a torn payload");
+        check(fs::file_size(path, ec) == complete, "a torn payload is truncated");
+        bytes = readBytes(path);
+        bytes.insert(bytes.end(), {'R', 'P', 'K'});
+        writeBytes(path, bytes);
+        check(archive.open(path) && archive.size() == 3 && fs::file_size(path, ec) == complete, "a torn header is truncated");
+        check(archive.append(9, {9}), "an archive is writable after a torn tail is cut off");
+        
+        // verify() catches a flipped payload byte and nothing else
+        vector<uint64_t> starts = writeArchive(path, objects);
+        BackupArchive::VerifyResult clean = archive.open(path) ? archive.verify() : BackupArchive::VerifyResult();
+        check(clean.checked == 3 && clean.corrupt == 0 && clean.damage.empty(), "verify accepts an intact archive");
+        bytes = readBytes(path);
+        bytes[starts[2] + 32 + 3] ^= 0x5A;
+        writeBytes(path, bytes);
+        vector<uint8_t> raw;
+        BackupArchive::VerifyResult flipped = archive.open(path) ? archive.verify() : BackupArchive::VerifyResult();
+        check(flipped.checked == 3 && flipped.corrupt == 1, "verify catches a flipped payload byte");
+        check(!archive.read(3, raw) && archive.read(2, raw) && raw == objects[1], "a flipped byte fails only its own entry");
+        
+        // Damage with data after it is never cut off
+        starts = writeArchive(path, objects);
+        complete = fs::file_size(path, ec);
+        bytes = readBytes(path);
+        bytes[starts[1]] = 'X';
+        writeBytes(path, bytes);
+        check(archive.open(path) && archive.size() == 1 && !archive.damage().empty(), "bad magic stops the scan and is reported");
+        check(fs::file_size(path, ec) == complete && readBytes(path) == bytes, "bad magic leaves the file untouched");
+        check(!archive.append(9, {9}), "a damaged archive refuses appends");
+        check(archive.read(1, raw) && raw == objects[0], "entries before the damage stay readable");
+        
+        starts = writeArchive(path, objects);
+        bytes = readBytes(path);
+        bytes[starts[2] + 4] = 99;
+        writeBytes(path, bytes);
+        check(archive.open(path) && archive.size() == 2 && archive.damage().find("version 99") != string::npos,
+              "an unknown entry version is reported");
+        check(readBytes(path) == bytes, "an unknown entry version is kept");
+        check(!archive.verify().damage.empty(), "verify reports the damage");
+    }
+    
+    static RegistrySnapshot planBaseline() {
+        RegistrySnapshot baseline;
+        baseline.keys.push_back({RegionalSettingsManager::kIntlKey, {}});
+        baseline.keys[0].values.push_back({"sShortDate", REG_SZ, utf8ToRegistryString("M/d/yyyy")});
+        baseline.keys[0].values.push_back({"sList", REG_SZ, utf8ToRegistryString(",")});
+        baseline.keys[0].values.push_back({"sCreated", RegistrySnapshot::kAbsentType, {}});
+        return baseline;
+    }
+    
+    // The live values a plan's reads would see for baseline
+    static RegistrySnapshot presentValues(RegistrySnapshot baseline) {
+        auto& values = baseline.keys[0].values;
+        values.erase(remove_if(values.begin(), values.end(), [](const RegistrySnapshot::Value& v) { return v.absent(); }),
+                     values.end());
+        return baseline;
+    }
+    
+    void changePlan() {
+        string path = (scratch / "de-DE.rplan").string();
+        const LocaleView& info = kBuiltinLocales[0];
+        ChangePlan plan;
+        plan.locale = info.tag;
+        plan.baseline = "live-0123456789abcdef";
+        check(ChangePlan::fromBatch(RegionalSettingsManager::localeBatch(plan.locale, info), plan) && plan.size() == 10,
+              "plan captures a locale's writes");
+        check(plan.save(path), "plan saves");
+        
+        ChangePlan loaded;
+        check(ChangePlan::load(path, loaded) && loaded.locale == plan.locale && loaded.baseline == plan.baseline &&
+                  sameSnapshot(loaded.ops, plan.ops), "plan round-trips");
+        check(loaded.batch().size() == plan.size(), "a loaded plan rebuilds its batch");
+        
+        vector<uint8_t> bytes = readBytes(path);
+        for (size_t at : {size_t(5), size_t(12), bytes.size() / 2, bytes.size() - 1}) {
+            vector<uint8_t> damaged = bytes;
+            damaged[at] ^= 0x5A;
+            writeBytes(path, damaged);
+            check(!ChangePlan::load(path, loaded), "plan with byte " + to_string(at) + " flipped is rejected");
+        }
+        vector<uint8_t> future = bytes;
+        future[4] = 2;
+        uint32_t checksum = fnv1a32(future.data(), future.size() - 4);
+        for (int i = 0; i < 4; i++) future[future.size() - 4 + i] = static_cast<uint8_t>(checksum >> (8 * i));
+        writeBytes(path, future);
+        check(!ChangePlan::load(path, loaded), "plan of an unknown version is rejected");
+        writeBytes(path, vector<uint8_t>(bytes.begin(), bytes.end() - 9));
+        check(!ChangePlan::load(path, loaded), "truncated plan is rejected");
+        
+        check(RegionalSettingsManager::planViolation(plan).empty(), "a locale plan is acceptable");
+        ChangePlan outside = plan;
+        outside.ops.keys[0].path = "Software\\Microsoft\\Windows\\CurrentVersion\\Run";
+        check(RegionalSettingsManager::planViolation(outside).find("writes outside") == 0, "a plan writing another key is refused");
+        ChangePlan binary = plan;
+        binary.ops.keys[0].values[0].type = REG_BINARY;
+        check(RegionalSettingsManager::planViolation(binary).find("unsupported type") == 0, "a plan writing REG_BINARY is refused");
+        
+        // The manager resolves store ids against ./backups, so run it inside the scratch directory
+        error_code ec;
+        fs::path previous = fs::current_path(ec);
+        fs::create_directories(scratch / "plan", ec);
+        fs::current_path(scratch / "plan", ec);
+        ofstream("config.json") << "{\"log_level\": \"error\"}";
+        {
+            RegistrySnapshot baseline = planBaseline();
+            RegistrySnapshot live = presentValues(baseline);
+            RegistrySnapshot drifted = live;
+            drifted.keys[0].values[0].data = utf8ToRegistryString("dd.MM.yyyy");
+            RegistrySnapshot resurrected = live;
+            resurrected.keys[0].values.push_back({"sCreated", REG_SZ, utf8ToRegistryString("x")});
+            
+            string id = BackupStore("backups").commit(baseline, "HKEY_CURRENT_USER\\Control Panel\\International");
+            check(!id.empty() && NativeBackup::save(baseline, "baseline.rsnap"), "plan baselines are stored");
+            RegionalSettingsManager manager(true);
+            
+            ChangePlan onLive = plan;
+            onLive.baseline = RegionalSettingsManager::liveBaselineId(live);
+            check(manager.baselineHolds(onLive, live), "a live baseline holds on the same values");
+            check(!manager.baselineHolds(onLive, drifted), "a live baseline fails once a value changes");
+            
+            for (const string& reference : {id, string("baseline.rsnap")}) {
+                ChangePlan onSnapshot = plan;
+                onSnapshot.baseline = reference;
+                check(manager.baselineHolds(onSnapshot, live), "snapshot baseline " + reference + " holds on its values");
+                check(!manager.baselineHolds(onSnapshot, drifted), "snapshot baseline " + reference + " fails once a value changes");
+                check(!manager.baselineHolds(onSnapshot, resurrected),
+                      "snapshot baseline " + reference + " fails once a value it recorded absent exists");
+            }
+        }
+        fs::current_path(previous, ec);
+    }
+    
+    void section(const char* name, void (SelfTest::*body)()) {
+        size_t before = failures;
+        (this->*body)();
+        cout << (failures == before ? "PASS " : "FAIL ") << name << "\n";
+    }
+    
+public:
+    // 0 when every check passed
+    int run() {
+        scratch = fs::temp_directory_path() /
+            ("regreset-selftest-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+        error_code ec;
+        fs::create_directories(scratch, ec);
+        if (ec) {
+            cout << "FAIL cannot create " << scratch.string() << "\n";
+            return 1;
+        }
+        section("json_reader", &SelfTest::jsonReader);
+        section("locale_catalog", &SelfTest::localeCatalog);
+        section("backup_store", &SelfTest::backupStore);
+        section("lz4", &SelfTest::lz4Codec);
+        section("backup_archive", &SelfTest::backupArchive);
+        section("change_plan", &SelfTest::changePlan);
+        fs::remove_all(scratch, ec);
+        cout << checks << " check(s), " << failures << " failure(s)\n";
+        return failures == 0 ? 0 : 1;
+    }
+};
+
 int main(int argc, char* argv[]) {
-    RegionalSettingsManager manager;
-    manager.printBanner();
+    auto launched = chrono::steady_clock::now();
+    vector<string> args(argv + 1, argv + argc);
+    auto takeFlag = [&args](const string& name) {
+        auto it = find(args.begin(), args.end(), name);
+        if (it == args.end()) return false;
+        args.erase(it);
+        return true;
+    };
+    bool force = takeFlag("--force");
+    // Scripted use: no banner or prompts, and a bare run applies default_locale
+    bool headless = takeFlag("--headless");
+    if (headless) force = true;
+    auto takeOption = [&args](const string& name) {
+        string value;
+        auto it = find(args.begin(), args.end(), name);
+        if (it != args.end() && it + 1 != args.end()) {
+            value = *(it + 1);
+            args.erase(it, it + 2);
+        }
+        return value;
+    };
+    int jobs = atoi(takeOption("--jobs").c_str());
+    string reportPath = takeOption("--report");
+    int latencyUs = atoi(takeOption("--latency").c_str());
+    string baselineRef = takeOption("--baseline");
+    
+    // Benchmarks run before the manager exists: no banner, config or log file
+    if (!args.empty() && args[0] == "--bench" && args.size() <= 2) {
+        int threads = args.size() == 2 ? atoi(args[1].c_str()) : 0;
+        Benchmark bench(static_cast<size_t>(max(threads, 0)), chrono::microseconds(max(latencyUs, 0)));
+        string json = bench.run();
+        cout << json;
+        if (!reportPath.empty()) {
+            ofstream out(reportPath, ios::trunc);
+            out << json;
+            if (!out.good()) {
+                cerr << "Error: could not write " << reportPath << "\n";
+                return 1;
+            }
+        }
+        return 0;
+    }
+    
+    if (!args.empty() && args[0] == "--self-test" && args.size() == 1) {
+        return SelfTest().run();
+    }
     
-    if (argc == 1) {
+    RegionalSettingsManager manager(headless, launched);
+    if (!headless) manager.printBanner();
+    
+    if (args.empty() && headless) {
+        bool ok = manager.applyLocale(manager.defaultLocale(), true);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args.empty()) {
         manager.interactiveMenu();
-    } else if (argc == 2) {
-        string locale = argv[1];
-        if (locale == "--help" || locale == "-h") {
-            cout << "\nUsage: " << argv[0] << " [locale|--interactive]\n";
-            cout << "\nOptions:\n";
-            cout << "  locale          Apply specific locale (e.g., pl-PL, en-US)\n";
-            cout << "  --interactive   Start interactive menu\n";
-            cout << "  --help          Show this help\n";
-            cout << "\nExamples:\n";
-            cout << "  " << argv[0] << "                 # Interactive menu\n";
-            cout << "  " << argv[0] << " pl-PL           # Apply Polish locale\n";
-            cout << "  " << argv[0] << " --interactive   # Interactive menu\n\n";
-            manager.listLocales();
-            return 0;
-        } else if (locale == "--interactive") {
-            manager.interactiveMenu();
-        } else {
-            manager.applyLocale(locale, false);
+    } else if (args[0] == "--help" || args[0] == "-h") {
+        cout << "\nUsage: " << argv[0] << " [locale|--interactive|--all-profiles [locale]|--rollback [id]|--manifest <file>|--fleet <hosts>] [--force|--headless]\n";
+        cout << "\nOptions:\n";
+        cout << "  locale                  Apply specific locale (e.g., pl-PL, en-US)\n";
+        cout << "                          Loose tags resolve to the nearest match (de, de_AT, EN-us)\n";
+        cout << "  --interactive           Start interactive menu\n";
+        cout << "  --all-profiles [locale] Apply locale to every user profile (default: config default_locale)\n";
+        cout << "  --compile-catalog [out] Build the binary locale catalog from the JSON sources\n";
+        cout << "  --watch                 Stay resident and re-apply default_locale when settings drift\n";
+        cout << "  --rollback [id|file]    Restore a backup snapshot (default: the latest for this user)\n";
+        cout << "  --verify-backups        Check every archived backup snapshot against its checksum\n";
+        cout << "  --manifest <file>       Apply \"<target> [locale]\" lines without prompting; target is\n";
+        cout << "                          current, a profile SID or an NTUSER.DAT path\n";
+        cout << "  --fleet <hosts>         Apply \"<host> [locale]\" lines to every loaded profile on each\n";
+        cout << "                          remote host over RegConnectRegistry\n";
+        cout << "  --plan <locale> [out]   Save the writes <locale> needs as a change plan (default: <locale>.rplan)\n";
+        cout << "  --baseline <id|file>    Plan against a backup snapshot instead of the live values\n";
+        cout << "  --apply-plan <file>     Execute a change plan for the current user, no lookups or diff\n";
+        cout << "  --jobs <n>              Manifest workers, or concurrent --fleet connections\n";
+        cout << "                          (default: max_parallel_profiles / max_remote_connections)\n";
+        cout << "  --report <file>         Manifest or fleet report (default: <file>.report.jsonl),\n";
+        cout << "                          or where --bench also writes its JSON results\n";
+        cout << "  --bench [threads]       Benchmark apply, backup and logging against an in-memory\n";
+        cout << "                          registry, scaling 1..threads (default: all cores)\n";
+        cout << "  --latency <us>          Simulated per-call registry latency for --bench\n";
+        cout << "  --stress [threads] [n]  Concurrent applies against an in-memory registry while the\n";
+        cout << "                          settings are reloaded; run under TSan by the stress target\n";
+        cout << "  --self-test             Round-trip checks of the parsers and file formats (ctest)\n";
+        cout << "  --force                 Skip the confirmation prompt\n";
+        cout << "  --headless              Scripted run: no banner or prompts, logs the startup time;\n";
+        cout << "                          with no locale it applies config default_locale\n";
+        cout << "  --help                  Show this help\n";
+        cout << "\nExamples:\n";
+        cout << "  " << argv[0] << "                        # Interactive menu\n";
+        cout << "  " << argv[0] << " pl-PL                  # Apply Polish locale\n";
+        cout << "  " << argv[0] << " --interactive          # Interactive menu\n";
+        cout << "  " << argv[0] << " --all-profiles en-US   # Apply to all user profiles\n";
+        cout << "  " << argv[0] << " --manifest fleet.txt   # Bulk apply from a manifest\n";
+        cout << "  " << argv[0] << " --headless             # Logon script: apply default_locale\n\n";
+        manager.listLocales();
+        return 0;
+    } else if (args[0] == "--interactive" && args.size() == 1) {
+        if (headless) {
+            cout << "Error: --interactive cannot be combined with --headless.\n";
+            return 1;
         }
+        manager.interactiveMenu();
+    } else if (args[0] == "--all-profiles" && args.size() <= 2) {
+        manager.applyAllProfiles(args.size() == 2 ? args[1] : manager.defaultLocale(), force);
+    } else if (args[0] == "--watch" && args.size() == 1) {
+        bool ok = manager.watch();
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--rollback" && args.size() <= 2) {
+        bool ok = manager.rollback(args.size() == 2 ? args[1] : "");
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--verify-backups" && args.size() == 1) {
+        bool ok = manager.verifyBackups();
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--manifest" && args.size() == 2) {
+        bool ok = manager.applyManifest(args[1], jobs, reportPath);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--fleet" && args.size() == 2) {
+        bool ok = manager.applyFleet(args[1], jobs, reportPath);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--plan" && (args.size() == 2 || args.size() == 3)) {
+        bool ok = manager.createPlan(args[1], args.size() == 3 ? args[2] : "", baselineRef);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--apply-plan" && args.size() == 2) {
+        bool ok = manager.applyPlan(args[1]);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--stress" && args.size() <= 3) {
+        size_t threads = args.size() >= 2 ? static_cast<size_t>(max(atoi(args[1].c_str()), 0)) : 0;
+        size_t rounds = args.size() == 3 ? static_cast<size_t>(max(atoi(args[2].c_str()), 1)) : 500;
+        bool ok = manager.stress(threads, rounds);
+        manager.showStatistics();
+        return ok ? 0 : 1;
+    } else if (args[0] == "--compile-catalog" && args.size() <= 2) {
+        return manager.compileCatalog(args.size() == 2 ? args[1] : "") ? 0 : 1;
+    } else if (args.size() == 1) {
+        manager.applyLocale(args[0], force);
     } else {
         cout << "Error: Too many arguments. Use --help for usage information.\n";
         return 1;
@@ -547,4 +8123,4 @@ int main(int argc, char* argv[]) {
     
     manager.showStatistics();
     return 0;
-}
\ No newline at end of file
+}